@@ -25,21 +25,29 @@
 
 #include "QsLog.h"
 #include "QsLogDest.h"
+#include "QsLogDestRecorder.h"
 #ifdef QS_LOG_SEPARATE_THREAD
 #include <QThreadPool>
 #include <QRunnable>
 #endif
 #include <QMutex>
+#include <QLoggingCategory>
 #include <QVector>
 #include <QDateTime>
+#include <QThread>
+#include <QAtomicInt>
+#include <QSharedPointer>
 #include <QtGlobal>
 #include <cstdlib>
+#include <iostream>
 #include <stdexcept>
 
 namespace QsLogging
 {
 typedef QVector<DestinationPtr> DestinationList;
 
+static void FilterQtCategory(QLoggingCategory* category);
+
 static const char TraceString[] = "TRACE";
 static const char DebugString[] = "DEBUG";
 static const char InfoString[]  = "INFO ";
@@ -52,6 +60,13 @@ static const QString fmtDateTime("yyyy-MM-ddThh:mm:ss.zzz");
 
 static Logger* sInstance = 0;
 
+// the Qt message handler and category filter are process-wide, so is what they replaced
+static QtMessageHandler sPreviousQtMessageHandler = 0;
+static QLoggingCategory::CategoryFilter sPreviousCategoryFilter = 0;
+
+// set while the current thread is inside Logger::write, to catch warnings raised by destinations
+static thread_local bool sIsWriting = false;
+
 static const char* LevelToText(Level theLevel)
 {
     switch (theLevel) {
@@ -80,12 +95,12 @@ static const char* LevelToText(Level theLevel)
 class LogWriterRunnable : public QRunnable
 {
 public:
-    LogWriterRunnable(QString message, Level level);
+    LogWriterRunnable(const LogMessage& message, Logger::WriteMode mode);
     virtual void run();
 
 private:
-    QString mMessage;
-    Level mLevel;
+    LogMessage mMessage;
+    Logger::WriteMode mMode;
 };
 #endif
 
@@ -99,30 +114,38 @@ public:
 #endif
     QMutex logMutex;
     Level level;
+    Level effectiveLevel; // lowest of level and the destinations' capture levels
+    Level durableLevel;
     DestinationList destList;
     bool includeTimeStamp;
     bool includeLogLevel;
+    bool includeThreadName;
+    bool routesQtMessages;
 };
 
 #ifdef QS_LOG_SEPARATE_THREAD
-LogWriterRunnable::LogWriterRunnable(QString message, Level level)
+LogWriterRunnable::LogWriterRunnable(const LogMessage& message, Logger::WriteMode mode)
     : QRunnable()
     , mMessage(message)
-    , mLevel(level)
+    , mMode(mode)
 {
 }
 
 void LogWriterRunnable::run()
 {
-    Logger::instance().write(mMessage, mLevel);
+    Logger::instance().write(mMessage, mMode);
 }
 #endif
 
 
 LoggerImpl::LoggerImpl()
     : level(InfoLevel)
+    , effectiveLevel(InfoLevel)
+    , durableLevel(OffLevel)
     , includeTimeStamp(true)
     , includeLogLevel(true)
+    , includeThreadName(false)
+    , routesQtMessages(false)
 {
     // assume at least file + console
     destList.reserve(2);
@@ -179,6 +202,12 @@ Level Logger::levelFromLogMessage(const QString& logMessage, bool* conversionSuc
 
 Logger::~Logger()
 {
+    if (d->routesQtMessages) {
+        qInstallMessageHandler(sPreviousQtMessageHandler);
+        QLoggingCategory::installFilter(sPreviousCategoryFilter);
+        sPreviousQtMessageHandler = 0;
+        sPreviousCategoryFilter = 0;
+    }
 #ifdef QS_LOG_SEPARATE_THREAD
     d->threadPool.waitForDone();
 #endif
@@ -190,17 +219,64 @@ void Logger::removeDestination(DestinationPtr destination)
 {
 	Q_ASSERT(destination.data());
 	d->destList.removeAll(destination);
+	updateEffectiveLevel();
+}
+
+static bool IsRecorderTarget(const DestinationPtr& recorder, const DestinationPtr& target)
+{
+    const FlightRecorderDestination* flightRecorder =
+        dynamic_cast<const FlightRecorderDestination*>(recorder.data());
+    return flightRecorder && flightRecorder->target() == target;
 }
 
-void Logger::addDestination(DestinationPtr destination)
+bool Logger::addDestination(DestinationPtr destination)
 {
     Q_ASSERT(destination.data());
+    // a flight recorder dumps to its target without the logger's lock
+    for (DestinationList::const_iterator it = d->destList.constBegin(),
+        endIt = d->destList.constEnd();it != endIt;++it) {
+        if (IsRecorderTarget(*it, destination) || IsRecorderTarget(destination, *it)) {
+            std::cerr << "QsLog: a flight recorder's target can't be a logger destination too"
+                      << std::endl;
+            return false;
+        }
+    }
     d->destList.push_back(destination);
+    updateEffectiveLevel();
+    return true;
+}
+
+void Logger::updateEffectiveLevel()
+{
+    // nothing needs building that no destination takes
+    Level level = d->destList.isEmpty() ? d->level : OffLevel;
+    for (DestinationList::const_iterator it = d->destList.constBegin(),
+        endIt = d->destList.constEnd();it != endIt;++it) {
+        level = qMin(level, qMax(d->level, (*it)->level()));
+        level = qMin(level, (*it)->captureLevel());
+    }
+    d->effectiveLevel = level;
+    // makes Qt re-evaluate which categories are enabled
+    if (d->routesQtMessages)
+        QLoggingCategory::installFilter(FilterQtCategory);
+}
+
+void Logger::flush()
+{
+#ifdef QS_LOG_SEPARATE_THREAD
+    d->threadPool.waitForDone();
+#endif
+    QMutexLocker lock(&d->logMutex);
+    for (DestinationList::iterator it = d->destList.begin(),
+        endIt = d->destList.end();it != endIt;++it) {
+        (*it)->flush();
+    }
 }
 
 void Logger::setLoggingLevel(Level newLevel)
 {
     d->level = newLevel;
+    updateEffectiveLevel();
 }
 
 Level Logger::loggingLevel() const
@@ -208,6 +284,35 @@ Level Logger::loggingLevel() const
     return d->level;
 }
 
+static ScopedLogBuffer*& CurrentLogBuffer()
+{
+    static thread_local ScopedLogBuffer* buffer = 0;
+    return buffer;
+}
+
+// buffers alive in any thread, spares the thread-local lookup when there are none
+static QAtomicInt sActiveLogBuffers;
+
+Level Logger::effectiveLevel() const
+{
+    if (!sActiveLogBuffers.loadAcquire())
+        return d->effectiveLevel;
+    const ScopedLogBuffer* buffer = CurrentLogBuffer();
+    if (buffer && buffer->mLowestLevel < d->effectiveLevel)
+        return buffer->mLowestLevel;
+    return d->effectiveLevel;
+}
+
+void Logger::setDurableLevel(Level level)
+{
+    d->durableLevel = level;
+}
+
+Level Logger::durableLevel() const
+{
+    return d->durableLevel;
+}
+
 void Logger::setIncludeTimestamp(bool e)
 {
     d->includeTimeStamp = e;
@@ -228,24 +333,297 @@ bool Logger::includeLogLevel() const
     return d->includeLogLevel;
 }
 
-//! creates the complete log message and passes it to the logger
-void Logger::Helper::writeToLog()
+void Logger::setIncludeThreadName(bool t)
 {
-    const char* const levelName = LevelToText(level);
-    QString completeMessage;
-    Logger &logger = Logger::instance();
+    d->includeThreadName = t;
+}
+
+bool Logger::includeThreadName() const
+{
+    return d->includeThreadName;
+}
+
+namespace
+{
+// Per-thread copy of the thread's identity. The name is looked up again only after
+// QThread::objectNameChanged fired, which may happen from any thread, hence the atomic flag.
+struct ThreadIdentity
+{
+    ThreadIdentity() : id(0), renamed(new QAtomicInt(1)) {}
+
+    quint64 id;
+    QString name;
+    QSharedPointer<QAtomicInt> renamed;
+};
+}
+
+static const ThreadIdentity& CurrentThreadIdentity()
+{
+    static thread_local ThreadIdentity identity;
+    if (identity.renamed->loadAcquire()) {
+        QThread* thread = QThread::currentThread();
+        if (!identity.id) {
+            identity.id = reinterpret_cast<quintptr>(QThread::currentThreadId());
+            // the flag is shared so the connection stays valid after this thread has exited
+            QSharedPointer<QAtomicInt> renamed = identity.renamed;
+            QObject::connect(thread, &QObject::objectNameChanged, [renamed]() {
+                renamed->storeRelease(1);
+            });
+        }
+        identity.renamed->storeRelease(0);
+        identity.name = thread->objectName();
+    }
+    return identity;
+}
+
+static LogContextPtr& CurrentContext()
+{
+    static thread_local LogContextPtr context;
+    return context;
+}
+
+//! fills in what the record needs to know about the logging thread
+static void CaptureThreadState(LogMessage& message)
+{
+    const ThreadIdentity& thread = CurrentThreadIdentity();
+    message.threadId = thread.id;
+    message.threadName = thread.name;
+    message.context = CurrentContext();
+}
+
+static Level LevelFromQtMessageType(QtMsgType type)
+{
+    switch (type) {
+        case QtDebugMsg:
+            return DebugLevel;
+        case QtInfoMsg:
+            return InfoLevel;
+        case QtWarningMsg:
+            return WarnLevel;
+        case QtCriticalMsg:
+            return ErrorLevel;
+        case QtFatalMsg:
+            return FatalLevel;
+        default:
+            return InfoLevel;
+    }
+}
+
+// Runs after the previous filter (which applies QT_LOGGING_RULES) and only ever disables types.
+static void FilterQtCategory(QLoggingCategory* category)
+{
+    if (sPreviousCategoryFilter)
+        sPreviousCategoryFilter(category);
+    if (!sInstance)
+        return;
+
+    const Level level = sInstance->effectiveLevel();
+    if (level > DebugLevel)
+        category->setEnabled(QtDebugMsg, false);
+    if (level > InfoLevel)
+        category->setEnabled(QtInfoMsg, false);
+    if (level > WarnLevel)
+        category->setEnabled(QtWarningMsg, false);
+    if (level > ErrorLevel)
+        category->setEnabled(QtCriticalMsg, false);
+}
+
+void Logger::installQtMessageHandler()
+{
+    if (d->routesQtMessages)
+        return;
+
+    d->routesQtMessages = true;
+    sPreviousQtMessageHandler = qInstallMessageHandler(&Logger::handleQtMessage);
+    sPreviousCategoryFilter = QLoggingCategory::installFilter(FilterQtCategory);
+}
+
+void Logger::handleQtMessage(QtMsgType type, const QMessageLogContext& context, const QString& text)
+{
+    // A destination producing a Qt warning would re-enter the logger and deadlock on its mutex,
+    // so such messages go to the previous handler instead.
+    if (sIsWriting || !sInstance) {
+        if (sPreviousQtMessageHandler)
+            sPreviousQtMessageHandler(type, context, text);
+        return;
+    }
+
+    const Level level = LevelFromQtMessageType(type);
+    if (level < sInstance->effectiveLevel())
+        return;
+
+    LogMessage message(text, level, QDateTime::currentMSecsSinceEpoch());
+    CaptureThreadState(message);
+    if (context.category && qstrcmp(context.category, "default"))
+        message.category = context.category;
+
+    // Qt aborts as soon as the handler returns from a fatal message, so don't queue it: write it
+    // after the queued messages and flush everything
+    if (QtFatalMsg == type) {
+#ifdef QS_LOG_SEPARATE_THREAD
+        sInstance->d->threadPool.waitForDone();
+#endif
+        sInstance->write(message);
+        sInstance->flush();
+    } else {
+        sInstance->enqueueWrite(message);
+    }
+}
+
+void ScopedContext::push(const LogField& field)
+{
+    LogContextPtr& current = CurrentContext();
+    mPrevious = current;
+    current = LogContextPtr(new LogContext(field, current));
+}
+
+ScopedContext::~ScopedContext()
+{
+    CurrentContext() = mPrevious;
+}
+
+ScopedLogBuffer::ScopedLogBuffer(Level triggerLevel, Level lowestLevel, int maxRecords)
+    : mTriggerLevel(triggerLevel)
+    , mLowestLevel(lowestLevel)
+    , mMaxRecords(qMax(maxRecords, 1))
+    , mParent(CurrentLogBuffer())
+{
+    // inside an escalated scope everything is interesting already
+    mEscalated = mParent && mParent->mEscalated;
+    CurrentLogBuffer() = this;
+    sActiveLogBuffers.ref();
+}
+
+ScopedLogBuffer::~ScopedLogBuffer()
+{
+    sActiveLogBuffers.deref();
+    CurrentLogBuffer() = mParent;
+}
+
+bool ScopedLogBuffer::isEscalated() const
+{
+    return mEscalated;
+}
+
+QDebug operator<<(QDebug dbg, const LogField& field)
+{
+    QString text = QString::fromUtf8(field.key);
+    text.append('=');
+    LogMessage::appendFieldValue(text, field.value);
+    dbg << qPrintable(text);
+    return dbg;
+}
+
+LogMessage::LogMessage()
+    : level(InfoLevel)
+    , timestamp(0)
+    , threadId(0)
+    , location(0)
+    , mIsFormatted(false)
+{
+}
+
+LogMessage::LogMessage(const QString& message_, Level level_, qint64 timestamp_)
+    : message(message_)
+    , level(level_)
+    , timestamp(timestamp_)
+    , threadId(0)
+    , location(0)
+    , mIsFormatted(false)
+{
+}
+
+const QString& LogMessage::formatted() const
+{
+    if (mIsFormatted)
+        return mFormatted;
+    mIsFormatted = true;
+
+    const Logger &logger = Logger::instance();
     if (logger.includeLogLevel()) {
-        completeMessage.
-                append(levelName).
+        mFormatted.
+                append(LevelToText(level)).
                 append(' ');
     }
     if (logger.includeTimestamp()) {
-        completeMessage.
-                append(QDateTime::currentDateTime().toString(fmtDateTime)).
+        mFormatted.
+                append(QDateTime::fromMSecsSinceEpoch(timestamp).toString(fmtDateTime)).
+                append(' ');
+    }
+    if (logger.includeThreadName()) {
+        mFormatted.
+                append('[').
+                append(threadLabel()).
+                append("] ");
+    }
+    if (location) {
+        mFormatted.
+                append(QLatin1String(location)).
                 append(' ');
     }
-    completeMessage.append(buffer);
-    Logger::instance().enqueueWrite(completeMessage, level);
+    if (!category.isEmpty()) {
+        mFormatted.
+                append(QString::fromUtf8(category)).
+                append(": ");
+    }
+    mFormatted.append(message);
+    appendFields(mFormatted);
+    return mFormatted;
+}
+
+void LogMessage::appendFields(QString& out) const
+{
+    const LogFieldList allFields = context.data() ? contextFields() + fields : fields;
+    for (LogFieldList::const_iterator it = allFields.constBegin(), endIt = allFields.constEnd();
+        it != endIt;++it) {
+        if (!out.isEmpty() && !out.endsWith(' '))
+            out.append(' ');
+        out.append(QString::fromUtf8(it->key)).append('=');
+        appendFieldValue(out, it->value);
+    }
+}
+
+LogFieldList LogMessage::contextFields() const
+{
+    LogFieldList result;
+    for (const LogContext* entry = context.data();entry;entry = entry->parent.data())
+        result.prepend(entry->field);
+    return result;
+}
+
+QString LogMessage::threadLabel() const
+{
+    if (!threadName.isEmpty())
+        return threadName;
+
+    return QString::fromLatin1("0x") + QString::number(threadId, 16);
+}
+
+void LogMessage::appendFieldValue(QString& out, const QVariant& value)
+{
+    const QString text = value.toString();
+    if (!text.contains(' ') && !text.contains('"') && !text.isEmpty()) {
+        out.append(text);
+        return;
+    }
+
+    out.append('"');
+    for (int i = 0;i < text.size();++i) {
+        if (text.at(i) == '"' || text.at(i) == '\\')
+            out.append('\\');
+        out.append(text.at(i));
+    }
+    out.append('"');
+}
+
+//! captures the streamed text and fields and passes the record to the logger
+void Logger::Helper::writeToLog()
+{
+    LogMessage message(buffer, level, QDateTime::currentMSecsSinceEpoch());
+    CaptureThreadState(message);
+    message.location = location;
+    message.fields.swap(fields);
+    Logger::instance().enqueueWrite(message);
 }
 
 Logger::Helper::~Helper()
@@ -259,25 +637,92 @@ Logger::Helper::~Helper()
     }
 }
 
+//! Keeps the message back when the thread is in a ScopedLogBuffer, otherwise passes it on.
+void Logger::enqueueWrite(const LogMessage& message)
+{
+    ScopedLogBuffer* buffer = CurrentLogBuffer();
+    if (!buffer || message.level < buffer->mLowestLevel) {
+        enqueueWrite(message, NormalWrite);
+        return;
+    }
+
+    if (message.level >= buffer->mTriggerLevel && !buffer->mEscalated)
+        escalate(buffer);
+    if (!buffer->mEscalated && message.level < d->level) {
+        // destinations capturing below the logging level take it now, the rest on escalation
+        if (message.level >= d->effectiveLevel)
+            enqueueWrite(message, NormalWrite);
+        if (buffer->mRecords.size() >= buffer->mMaxRecords)
+            buffer->mRecords.removeFirst();
+        buffer->mRecords.append(message);
+        return;
+    }
+    enqueueWrite(message, buffer->mEscalated ? EscalatedWrite : NormalWrite);
+}
+
+//! Writes out the kept records of the buffer and the buffers around it, oldest first.
+void Logger::escalate(ScopedLogBuffer* buffer)
+{
+    QList<ScopedLogBuffer*> chain;
+    for (ScopedLogBuffer* it = buffer;it && !it->mEscalated;it = it->mParent)
+        chain.prepend(it);
+
+    for (QList<ScopedLogBuffer*>::const_iterator it = chain.constBegin(), endIt = chain.constEnd();
+        it != endIt;++it) {
+        (*it)->mEscalated = true;
+        for (int i = 0;i < (*it)->mRecords.size();++i)
+            enqueueWrite((*it)->mRecords.at(i), ReplayedWrite);
+        (*it)->mRecords.clear();
+    }
+}
+
 //! directs the message to the task queue or writes it directly
-void Logger::enqueueWrite(const QString& message, Level level)
+void Logger::enqueueWrite(const LogMessage& message, WriteMode mode)
 {
 #ifdef QS_LOG_SEPARATE_THREAD
-    LogWriterRunnable *r = new LogWriterRunnable(message, level);
+    // the caller has to wait for durable messages anyway, write them after what is queued
+    if (message.level >= d->durableLevel) {
+        d->threadPool.waitForDone();
+        write(message, mode);
+        return;
+    }
+    LogWriterRunnable *r = new LogWriterRunnable(message, mode);
     d->threadPool.start(r);
 #else
-    write(message, level);
+    write(message, mode);
 #endif
 }
 
-//! Sends the message to all the destinations. The level for this message is passed in case
-//! it's useful for processing in the destination.
-void Logger::write(const QString& message, Level level)
+//! Sends the message to all the destinations. Destinations can use the whole record or just
+//! its formatted text.
+void Logger::write(const LogMessage& message, WriteMode mode)
 {
     QMutexLocker lock(&d->logMutex);
+    sIsWriting = true;
+    // escalated records ignore the logger's level, not the destinations' own
+    const Level floor = mode == NormalWrite ? d->level : TraceLevel;
     for (DestinationList::iterator it = d->destList.begin(),
         endIt = d->destList.end();it != endIt;++it) {
-        (*it)->write(message, level);
+        const bool captured = message.level >= (*it)->captureLevel();
+        // filtered before any destination formats the record
+        if (message.level < qMax(floor, (*it)->level()) && !captured)
+            continue;
+        if (mode == ReplayedWrite && captured)
+            continue;
+        if (!(*it)->acceptsCategory(message.category))
+            continue;
+        (*it)->writeMessage(message);
+    }
+    sIsWriting = false;
+    if (message.level < d->durableLevel)
+        return;
+
+    // commit without the lock, so that callers logging meanwhile can share the commit
+    const DestinationList destinations = d->destList;
+    lock.unlock();
+    for (DestinationList::const_iterator it = destinations.constBegin(),
+        endIt = destinations.constEnd();it != endIt;++it) {
+        (*it)->commit();
     }
 }
 
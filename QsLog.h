@@ -29,7 +29,10 @@
 #include "QsLogLevel.h"
 #include "QsLogDest.h"
 #include <QDebug>
+#include <QList>
 #include <QString>
+#include <cstddef>
+#include <type_traits>
 
 #define QS_LOG_VERSION "2.0b3"
 
@@ -37,6 +40,7 @@ namespace QsLogging
 {
 class Destination;
 class LoggerImpl; // d pointer
+class ScopedLogBuffer;
 
 class QSLOG_SHARED_OBJECT Logger
 {
@@ -47,15 +51,28 @@ public:
 
     ~Logger();
 
-    //! Adds a log message destination. Don't add null destinations.
-    void addDestination(DestinationPtr destination);
+    //! Adds a log message destination. Don't add null destinations. Returns false without adding
+    //! it when it is a FlightRecorderDestination's target or a recorder whose target was added.
+    bool addDestination(DestinationPtr destination);
 	//! Removes a log message destination.
 	void removeDestination(DestinationPtr destination);
 
+    //! Writes out everything the destinations buffered. With QS_LOG_SEPARATE_THREAD the messages
+    //! queued so far are written first.
+    void flush();
+
     //! Logging at a level < 'newLevel' will be ignored
     void setLoggingLevel(Level newLevel);
     //! The default level is INFO
     Level loggingLevel() const;
+    //! The level the logging macros check: loggingLevel(), or lower when a destination captures
+    //! more (see Destination::captureLevel) or the thread is in a ScopedLogBuffer.
+    Level effectiveLevel() const;
+    //! Log calls at a level >= 'level' return only after the destinations committed the message,
+    //! for files that means it is on stable storage. Concurrent callers share one commit.
+    void setDurableLevel(Level level);
+    //! Default value is OffLevel, nothing waits.
+    Level durableLevel() const;
     //! Set to false to disable timestamp inclusion in log messages
     void setIncludeTimestamp(bool e);
     //! Default value is true.
@@ -64,25 +81,60 @@ public:
     void setIncludeLogLevel(bool l);
     //! Default value is true.
     bool includeLogLevel() const;
+    //! Set to true to include the thread name (or id, for unnamed threads) in log messages
+    void setIncludeThreadName(bool t);
+    //! Default value is false.
+    bool includeThreadName() const;
+
+    //! Routes qDebug/qWarning/qCDebug etc. through the logger. QtMsgType maps onto the QsLog
+    //! levels and the QLoggingCategory name is kept in the record. Qt categories are disabled
+    //! for the message types below the logging level, so filtered qCDebug calls cost nothing.
+    //! The previous handler is restored when the logger is destroyed.
+    void installQtMessageHandler();
 
     //! The helper forwards the streaming to QDebug and builds the final
-    //! log message.
+    //! log message. Structured fields created with kv() are kept aside in the record.
     class QSLOG_SHARED_OBJECT Helper
     {
     public:
-        explicit Helper(Level logLevel) :
+        explicit Helper(Level logLevel, const char* sourceLocation = 0) :
             level(logLevel),
+            location(sourceLocation),
             qtDebug(&buffer)
         {}
         ~Helper();
-        QDebug& stream(){ return qtDebug; }
+        Helper& stream(){ return *this; }
+
+        template <typename T>
+        Helper& operator<<(const T& value) { qtDebug << value; return *this; }
+        Helper& operator<<(const LogField& field) { fields.push_back(field); return *this; }
+
+        Helper& nospace() { qtDebug.nospace(); return *this; }
+        Helper& space() { qtDebug.space(); return *this; }
+        Helper& noquote() { qtDebug.noquote(); return *this; }
+        Helper& quote() { qtDebug.quote(); return *this; }
+        Helper& maybeSpace() { qtDebug.maybeSpace(); return *this; }
+        Helper& resetFormat() { qtDebug.resetFormat(); return *this; }
+        Helper& setAutoInsertSpaces(bool b) { qtDebug.setAutoInsertSpaces(b); return *this; }
+        bool autoInsertSpaces() const { return qtDebug.autoInsertSpaces(); }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+        Helper& verbosity(int verbosityLevel) { qtDebug.verbosity(verbosityLevel); return *this; }
+        int verbosity() const { return qtDebug.verbosity(); }
+#endif
+
+        //! The QDebug that formats the text, for code written against the QDebug stream()
+        //! returned before. Fields streamed into it directly become text.
+        QDebug& debug() { return qtDebug; }
+        operator QDebug&() { return qtDebug; }
 
     private:
         void writeToLog();
 
         Level level;
+        const char* location;
         QString buffer;
         QDebug qtDebug;
+        LogFieldList fields;
 	};
 
 private:
@@ -90,56 +142,149 @@ private:
     Logger(const Logger&);            // not available
     Logger& operator=(const Logger&); // not available
 
-    void enqueueWrite(const QString& message, Level level);
-    void write(const QString& message, Level level);
+    void enqueueWrite(const LogMessage& message);
+    enum WriteMode
+    {
+        NormalWrite,
+        EscalatedWrite, //!< below the logging level too
+        ReplayedWrite   //!< escalated, skips the destinations that captured it when it was kept
+    };
+
+    void enqueueWrite(const LogMessage& message, WriteMode mode);
+    void escalate(ScopedLogBuffer* buffer);
+    void write(const LogMessage& message, WriteMode mode = NormalWrite);
+    void updateEffectiveLevel();
+
+    static void handleQtMessage(QtMsgType type, const QMessageLogContext& context,
+                                const QString& text);
 
     LoggerImpl* d;
 
     friend class LogWriterRunnable;
 };
 
+//! Adds a key/value pair to every record logged by the current thread while it is in scope:
+//!     QsLogging::ScopedContext ctx("req", requestId);
+//! Contexts must be destroyed in reverse order of creation, which is what scoping gives you.
+class QSLOG_SHARED_OBJECT ScopedContext
+{
+public:
+    template <typename T>
+    ScopedContext(const char* key, const T& value) { push(kv(key, value)); }
+    explicit ScopedContext(const LogField& field) { push(field); }
+    ~ScopedContext();
+
+private:
+    ScopedContext(const ScopedContext&);            // not available
+    ScopedContext& operator=(const ScopedContext&); // not available
+
+    void push(const LogField& field);
+
+    LogContextPtr mPrevious;
+};
+
+//! Keeps back the records below the logging level that the current thread logs while it is in
+//! scope, e.g. while handling one request:
+//!     QsLogging::ScopedLogBuffer buffer;
+//! They are dropped when the scope ends, unless a record at the trigger level was logged in it:
+//! then they are written in order before that record and the rest of the scope logs at full
+//! detail. An escalation writes out the enclosing buffers too. Only the newest maxRecords are kept.
+//! Destinations capturing below the logging level (see Destination::captureLevel) get them at once.
+class QSLOG_SHARED_OBJECT ScopedLogBuffer
+{
+public:
+    explicit ScopedLogBuffer(Level triggerLevel = WarnLevel, Level lowestLevel = TraceLevel,
+                             int maxRecords = 1000);
+    ~ScopedLogBuffer();
+
+    //! true once a record at the trigger level was logged in the scope
+    bool isEscalated() const;
+
+private:
+    ScopedLogBuffer(const ScopedLogBuffer&);            // not available
+    ScopedLogBuffer& operator=(const ScopedLogBuffer&); // not available
+
+    friend class Logger;
+
+    Level mTriggerLevel;
+    Level mLowestLevel;
+    int mMaxRecords;
+    bool mEscalated;
+    ScopedLogBuffer* mParent;
+    QList<LogMessage> mRecords;
+};
+
+constexpr std::size_t laterOffset(std::size_t left, std::size_t right)
+{
+    return right != 0 ? right : left;
+}
+
+//! One past the last separator in path[begin, end), 0 without one. Halves the range, so the
+//! recursion stays shallow for deep build paths.
+constexpr std::size_t separatorEnd(const char* path, std::size_t begin, std::size_t end)
+{
+    return end - begin == 0 ? 0
+        : end - begin == 1 ? ((path[begin] == '/' || path[begin] == '\\') ? begin + 1 : 0)
+        : laterOffset(separatorEnd(path, begin, begin + (end - begin) / 2),
+                      separatorEnd(path, begin + (end - begin) / 2, end));
+}
+
+//! Offset of the file name inside a path, computed by the compiler for QS_LOG_LOCATION.
+template <std::size_t N>
+constexpr std::size_t basenameOffset(const char (&path)[N])
+{
+    return separatorEnd(path, 0, N - 1);
+}
+
 } // end namespace
 
+#define QS_LOG_STRINGIFY_(x) #x
+#define QS_LOG_STRINGIFY(x) QS_LOG_STRINGIFY_(x)
+//! "file.cpp:42" as a string literal, with the directories stripped at compile time
+#define QS_LOG_LOCATION_LITERAL __FILE__ ":" QS_LOG_STRINGIFY(__LINE__)
+#define QS_LOG_LOCATION (QS_LOG_LOCATION_LITERAL + std::integral_constant<std::size_t, \
+    QsLogging::basenameOffset(QS_LOG_LOCATION_LITERAL)>::value)
+
 //! Logging macros: define QS_LOG_LINE_NUMBERS to get the file and line number
 //! in the log output.
 #ifndef QS_LOG_LINE_NUMBERS
 #define QLOG_TRACE() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::TraceLevel) {} \
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::TraceLevel) {} \
     else QsLogging::Logger::Helper(QsLogging::TraceLevel).stream()
 #define QLOG_DEBUG() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::DebugLevel) {} \
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::DebugLevel) {} \
     else QsLogging::Logger::Helper(QsLogging::DebugLevel).stream()
 #define QLOG_INFO()  \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::InfoLevel) {} \
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::InfoLevel) {} \
     else QsLogging::Logger::Helper(QsLogging::InfoLevel).stream()
 #define QLOG_WARN()  \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::WarnLevel) {} \
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::WarnLevel) {} \
     else QsLogging::Logger::Helper(QsLogging::WarnLevel).stream()
 #define QLOG_ERROR() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::ErrorLevel) {} \
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::ErrorLevel) {} \
     else QsLogging::Logger::Helper(QsLogging::ErrorLevel).stream()
 #define QLOG_FATAL() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::FatalLevel) {} \
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::FatalLevel) {} \
     else QsLogging::Logger::Helper(QsLogging::FatalLevel).stream()
 #else
 #define QLOG_TRACE() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::TraceLevel) {} \
-    else  QsLogging::Logger::Helper(QsLogging::TraceLevel).stream() << __FILE__ << '@' << __LINE__
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::TraceLevel) {} \
+    else QsLogging::Logger::Helper(QsLogging::TraceLevel, QS_LOG_LOCATION).stream()
 #define QLOG_DEBUG() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::DebugLevel) {} \
-    else QsLogging::Logger::Helper(QsLogging::DebugLevel).stream() << __FILE__ << '@' << __LINE__
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::DebugLevel) {} \
+    else QsLogging::Logger::Helper(QsLogging::DebugLevel, QS_LOG_LOCATION).stream()
 #define QLOG_INFO()  \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::InfoLevel) {} \
-    else QsLogging::Logger::Helper(QsLogging::InfoLevel).stream() << __FILE__ << '@' << __LINE__
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::InfoLevel) {} \
+    else QsLogging::Logger::Helper(QsLogging::InfoLevel, QS_LOG_LOCATION).stream()
 #define QLOG_WARN()  \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::WarnLevel) {} \
-    else QsLogging::Logger::Helper(QsLogging::WarnLevel).stream() << __FILE__ << '@' << __LINE__
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::WarnLevel) {} \
+    else QsLogging::Logger::Helper(QsLogging::WarnLevel, QS_LOG_LOCATION).stream()
 #define QLOG_ERROR() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::ErrorLevel) {} \
-    else QsLogging::Logger::Helper(QsLogging::ErrorLevel).stream() << __FILE__ << '@' << __LINE__
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::ErrorLevel) {} \
+    else QsLogging::Logger::Helper(QsLogging::ErrorLevel, QS_LOG_LOCATION).stream()
 #define QLOG_FATAL() \
-    if (QsLogging::Logger::instance().loggingLevel() > QsLogging::FatalLevel) {} \
-    else QsLogging::Logger::Helper(QsLogging::FatalLevel).stream() << __FILE__ << '@' << __LINE__
+    if (QsLogging::Logger::instance().effectiveLevel() > QsLogging::FatalLevel) {} \
+    else QsLogging::Logger::Helper(QsLogging::FatalLevel, QS_LOG_LOCATION).stream()
 #endif
 
 #ifdef QS_LOG_DISABLE
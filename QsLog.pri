@@ -6,7 +6,14 @@ SOURCES += $$PWD/QsLogDest.cpp \
     $$PWD/QsLog.cpp \
     $$PWD/QsLogDestConsole.cpp \
     $$PWD/QsLogDestFile.cpp \
-    $$PWD/QsLogDestFunctor.cpp
+    $$PWD/QsLogDestFunctor.cpp \
+    $$PWD/QsLogLayout.cpp \
+    $$PWD/QsLogDestBinary.cpp \
+    $$PWD/QsLogDestRecorder.cpp \
+    $$PWD/QsLogDestRing.cpp \
+    $$PWD/QsLogDestRouting.cpp \
+    $$PWD/QsLogFileWriter.cpp \
+    $$PWD/QsLogCompression.cpp
 
 HEADERS += $$PWD/QsLogDest.h \
     $$PWD/QsLog.h \
@@ -14,7 +21,15 @@ HEADERS += $$PWD/QsLogDest.h \
     $$PWD/QsLogLevel.h \
     $$PWD/QsLogDestFile.h \
     $$PWD/QsLogDisableForThisFile.h \
-    $$PWD/QsLogDestFunctor.h
+    $$PWD/QsLogDestFunctor.h \
+    $$PWD/QsLogMessage.h \
+    $$PWD/QsLogLayout.h \
+    $$PWD/QsLogDestBinary.h \
+    $$PWD/QsLogDestRecorder.h \
+    $$PWD/QsLogDestRing.h \
+    $$PWD/QsLogDestRouting.h \
+    $$PWD/QsLogFileWriter.h \
+    $$PWD/QsLogCompression.h
 
 OTHER_FILES += \
     $$PWD/QsLogChanges.txt \
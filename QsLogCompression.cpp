@@ -0,0 +1,202 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLogCompression.h"
+#include <QFile>
+#include <QtEndian>
+#include <QtGlobal>
+#include <iostream>
+
+namespace
+{
+const char GzipMagic1 = '\x1f';
+const char GzipMagic2 = '\x8b';
+const char GzipDeflate = 8;
+const char GzipExtraFlag = 4;
+const char GzipUnknownOs = '\xff';
+// fixed header, extra field length, "QL" subfield with member size and zlib checksum
+const int GzipHeaderSize = 10 + 2 + 4 + 8;
+const int GzipTrailerSize = 8;
+
+quint32 Crc32(const QByteArray& data)
+{
+    static quint32 table[256];
+    static const bool tableReady = [] {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    Q_UNUSED(tableReady);
+
+    quint32 crc = 0xffffffffu;
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    for (int i = 0; i < data.size(); ++i)
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+void AppendLittleEndian(QByteArray* out, quint32 value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        out->append(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+quint32 ReadLittleEndian(const char* data, int bytes)
+{
+    quint32 value = 0;
+    for (int i = bytes - 1; i >= 0; --i)
+        value = (value << 8) | static_cast<uchar>(data[i]);
+    return value;
+}
+}
+
+QByteArray QsLogging::GzipCompress(const QByteArray& data)
+{
+    // qCompress: 4 byte size, 2 byte zlib header, raw deflate data, 4 byte adler32
+    QByteArray deflated("\x03\x00", 2);
+    quint32 adler = 1;
+    if (!data.isEmpty()) {
+        const QByteArray zlib = qCompress(data);
+        deflated = zlib.mid(6, zlib.size() - 10);
+        adler = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(zlib.constData() + zlib.size() - 4));
+    }
+
+    QByteArray member;
+    member.reserve(GzipHeaderSize + deflated.size() + GzipTrailerSize);
+    member.append(GzipMagic1);
+    member.append(GzipMagic2);
+    member.append(GzipDeflate);
+    member.append(GzipExtraFlag);
+    AppendLittleEndian(&member, 0, 4); // no modification time
+    member.append('\0');
+    member.append(GzipUnknownOs);
+    AppendLittleEndian(&member, 12, 2);
+    member.append('Q');
+    member.append('L');
+    AppendLittleEndian(&member, 8, 2);
+    AppendLittleEndian(&member, static_cast<quint32>(GzipHeaderSize + deflated.size() + GzipTrailerSize), 4);
+    AppendLittleEndian(&member, adler, 4);
+    member.append(deflated);
+    AppendLittleEndian(&member, Crc32(data), 4);
+    AppendLittleEndian(&member, static_cast<quint32>(data.size()), 4);
+    return member;
+}
+
+bool QsLogging::GzipDecompress(const QByteArray& data, QByteArray* output)
+{
+    int pos = 0;
+    while (pos < data.size()) {
+        const char* member = data.constData() + pos;
+        if (data.size() - pos < GzipHeaderSize + GzipTrailerSize
+            || member[0] != GzipMagic1 || member[1] != GzipMagic2 || member[2] != GzipDeflate
+            || member[3] != GzipExtraFlag || member[12] != 'Q' || member[13] != 'L')
+            return false;
+
+        const quint32 memberSize = ReadLittleEndian(member + 16, 4);
+        if (memberSize < quint32(GzipHeaderSize + GzipTrailerSize) || memberSize > quint32(data.size() - pos))
+            return false;
+        const char* trailer = member + memberSize - GzipTrailerSize;
+        const quint32 size = ReadLittleEndian(trailer + 4, 4);
+
+        // rebuild what qUncompress expects around the raw deflate data
+        QByteArray zlib;
+        zlib.reserve(static_cast<int>(memberSize));
+        zlib.append(static_cast<char>((size >> 24) & 0xff));
+        zlib.append(static_cast<char>((size >> 16) & 0xff));
+        zlib.append(static_cast<char>((size >> 8) & 0xff));
+        zlib.append(static_cast<char>(size & 0xff));
+        zlib.append("\x78\x9c", 2);
+        zlib.append(member + GzipHeaderSize, static_cast<int>(memberSize) - GzipHeaderSize - GzipTrailerSize);
+        const quint32 adler = ReadLittleEndian(member + 20, 4);
+        zlib.append(static_cast<char>((adler >> 24) & 0xff));
+        zlib.append(static_cast<char>((adler >> 16) & 0xff));
+        zlib.append(static_cast<char>((adler >> 8) & 0xff));
+        zlib.append(static_cast<char>(adler & 0xff));
+
+        const QByteArray inflated = size ? qUncompress(zlib) : QByteArray();
+        if (quint32(inflated.size()) != size || Crc32(inflated) != ReadLittleEndian(trailer, 4))
+            return false;
+        output->append(inflated);
+        pos += static_cast<int>(memberSize);
+    }
+    return true;
+}
+
+qint64 QsLogging::GzipCompleteSize(const QString& filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+
+    const qint64 fileSize = file.size();
+    qint64 pos = 0;
+    char header[GzipHeaderSize];
+    while (fileSize - pos >= GzipHeaderSize + GzipTrailerSize) {
+        if (!file.seek(pos) || file.read(header, GzipHeaderSize) != GzipHeaderSize
+            || header[0] != GzipMagic1 || header[1] != GzipMagic2 || header[2] != GzipDeflate
+            || header[3] != GzipExtraFlag || header[12] != 'Q' || header[13] != 'L')
+            break;
+        const quint32 memberSize = ReadLittleEndian(header + 16, 4);
+        if (memberSize < quint32(GzipHeaderSize + GzipTrailerSize) || memberSize > fileSize - pos)
+            break;
+        pos += memberSize;
+    }
+    return pos;
+}
+
+bool QsLogging::GzipFile(const QString& source, const QString& target)
+{
+    QFile input(source);
+    if (!input.open(QFile::ReadOnly)) {
+        std::cerr << "QsLog: could not read backup " << qPrintable(source);
+        return false;
+    }
+    const QByteArray compressed = GzipCompress(input.readAll());
+    input.close();
+
+    const QString temporaryName = target + QString::fromUtf8(".tmp");
+    QFile output(temporaryName);
+    if (!output.open(QFile::WriteOnly | QFile::Truncate)
+        || output.write(compressed) != compressed.size()) {
+        std::cerr << "QsLog: could not write compressed backup " << qPrintable(temporaryName);
+        output.close();
+        QFile::remove(temporaryName);
+        return false;
+    }
+    output.close();
+
+    QFile::remove(target);
+    if (!QFile::rename(temporaryName, target)) {
+        std::cerr << "QsLog: could not rename " << qPrintable(temporaryName)
+                  << " to " << qPrintable(target);
+        QFile::remove(temporaryName);
+        return false;
+    }
+    return QFile::remove(source);
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGCOMPRESSION_H
+#define QSLOGCOMPRESSION_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace QsLogging
+{
+//! Compresses 'data' into one gzip member with the zlib that comes with Qt. The header carries
+//! the member size and the zlib checksum in an extra field, so files made of several members
+//! can be read member by member. gzip and zcat read them like any other gzip file.
+QByteArray GzipCompress(const QByteArray& data);
+
+//! Inflates the members written by GzipCompress and appends them to 'output'. Returns false if
+//! the data is damaged or wasn't written by GzipCompress; the members before the damage, e.g.
+//! a frame cut short by a crash, are still appended.
+bool GzipDecompress(const QByteArray& data, QByteArray* output);
+
+//! Size of the complete members at the start of a file written with GzipCompress, found from
+//! their headers alone. Less than the file size when a crash cut the last member short.
+qint64 GzipCompleteSize(const QString& filePath);
+
+//! Writes 'source' compressed to 'target' and removes 'source'. The target is complete or
+//! missing, it is written under a temporary name first.
+bool GzipFile(const QString& source, const QString& target);
+
+}
+
+#endif // QSLOGCOMPRESSION_H
@@ -24,37 +24,189 @@
 // OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "QsLogDest.h"
+#include "QsLogDestBinary.h"
 #include "QsLogDestConsole.h"
 #include "QsLogDestFile.h"
 #include "QsLogDestFunctor.h"
+#include "QsLogDestRecorder.h"
+#include "QsLogDestRing.h"
+#include "QsLogLayout.h"
 #include <QString>
 
 namespace QsLogging
 {
 
+static LayoutPtr MakeLayout(LogFormat format)
+{
+    if (JsonLinesFormat == format)
+        return LayoutPtr(new JsonLayout);
+
+    return LayoutPtr(new TextLayout);
+}
+
+// A mapped file takes messages without a syscall, flushing after each one would add an msync per
+// message. Unless the caller chose a policy, it is flushed on a background cadence instead.
+static FlushPolicy FlushPolicyFor(FileBackend backend, const FlushPolicy& policy)
+{
+    const FlushPolicy defaults;
+    if (MappedFileBackend != backend || policy.messages != defaults.messages
+        || policy.bytes != defaults.bytes || policy.intervalMs != defaults.intervalMs
+        || policy.level != defaults.level)
+        return policy;
+
+    FlushPolicy cadence = FlushPolicy::manual();
+    cadence.intervalMs = 1000;
+    return cadence;
+}
+
+Destination::Destination()
+    : mLevel(TraceLevel)
+{
+}
+
 Destination::~Destination()
 {
 }
 
+void Destination::writeMessage(const LogMessage& message)
+{
+    write(message.formatted(), message.level);
+}
+
+void Destination::flush()
+{
+}
+
+void Destination::commit()
+{
+}
+
+Level Destination::captureLevel()
+{
+    return OffLevel;
+}
+
+void Destination::setLevel(Level level)
+{
+    mLevel = level;
+}
+
+void Destination::setCategories(const QList<QByteArray>& categories)
+{
+    mCategories = categories;
+}
+
+bool Destination::matchesCategory(const QByteArray& category) const
+{
+    for (QList<QByteArray>::const_iterator it = mCategories.constBegin(),
+        endIt = mCategories.constEnd();it != endIt;++it) {
+        if (categoryBelongsTo(category, *it))
+            return true;
+    }
+    return false;
+}
+
+bool Destination::categoryBelongsTo(const QByteArray& category, const QByteArray& name)
+{
+    if (category == name)
+        return true;
+    return !name.isEmpty() && category.size() > name.size() && category.startsWith(name)
+           && '.' == category.at(name.size());
+}
+
 //! destination factory
 DestinationPtr DestinationFactory::MakeFileDestination(const QString& filePath,
     LogRotationOption rotation, const MaxSizeBytes &sizeInBytesToRotateAfter,
-    const MaxOldLogCount &oldLogsToKeep)
+    const MaxOldLogCount &oldLogsToKeep, LogFormat format, const FlushPolicy &flushPolicy,
+    FileBackend backend, const RetentionPolicy &retention)
 {
-    if (EnableLogRotation == rotation) {
+    const FlushPolicy policy = FlushPolicyFor(backend, flushPolicy);
+#ifdef Q_OS_UNIX
+    if (EnableSharedLogRotation == rotation) {
+        QSharedPointer<SizeRotationStrategy> naming(new SizeRotationStrategy);
+        naming->setMaximumSizeInBytes(sizeInBytesToRotateAfter.size);
+        naming->setBackupCount(oldLogsToKeep.count);
+        QSharedPointer<SharedRotationStrategy> logRotation(new SharedRotationStrategy(naming));
+        logRotation->setMaximumSizeInBytes(sizeInBytesToRotateAfter.size);
+
+        // records must go out in single O_APPEND writes to interleave whole
+        return DestinationPtr(new FileDestination(filePath, logRotation, MakeLayout(format),
+                                                  flushPolicy, MakeFileWriter(NativeFileBackend)));
+    }
+#endif
+
+    if (EnableLogRotation == rotation || EnableCompressedLogRotation == rotation
+        || EnableSharedLogRotation == rotation) {
         QScopedPointer<SizeRotationStrategy> logRotation(new SizeRotationStrategy);
         logRotation->setMaximumSizeInBytes(sizeInBytesToRotateAfter.size);
         logRotation->setBackupCount(oldLogsToKeep.count);
+        logRotation->setCompressBackups(EnableCompressedLogRotation == rotation);
+
+        return DestinationPtr(new FileDestination(filePath, RotationStrategyPtr(logRotation.take()),
+                                                  MakeLayout(format), policy,
+                                                  MakeFileWriter(backend)));
+    }
+
+    if (EnableSequencedLogRotation == rotation) {
+        QScopedPointer<SequenceRotationStrategy> logRotation(new SequenceRotationStrategy);
+        logRotation->setMaximumSizeInBytes(sizeInBytesToRotateAfter.size);
+        logRotation->setBackupCount(oldLogsToKeep.count);
+        logRotation->setRetention(retention);
 
-        return DestinationPtr(new FileDestination(filePath, RotationStrategyPtr(logRotation.take())));
+        return DestinationPtr(new FileDestination(filePath, RotationStrategyPtr(logRotation.take()),
+                                                  MakeLayout(format), policy,
+                                                  MakeFileWriter(backend)));
     }
 
-    return DestinationPtr(new FileDestination(filePath, RotationStrategyPtr(new NullRotationStrategy)));
+    return DestinationPtr(new FileDestination(filePath, RotationStrategyPtr(new NullRotationStrategy),
+                                              MakeLayout(format), policy,
+                                              MakeFileWriter(backend)));
+}
+
+DestinationPtr DestinationFactory::MakeTimedFileDestination(const QString& filePath,
+    const RotationIntervalSeconds &interval, const MaxSizeBytes &sizeInBytesToRotateAfter,
+    const MaxOldLogCount &oldLogsToKeep, LogFormat format, const FlushPolicy &flushPolicy,
+    FileBackend backend, const RetentionPolicy &retention)
+{
+    const FlushPolicy policy = FlushPolicyFor(backend, flushPolicy);
+    QSharedPointer<TimeRotationStrategy> timeRotation(new TimeRotationStrategy);
+    timeRotation->setIntervalInSeconds(interval.seconds);
+    timeRotation->setBackupCount(oldLogsToKeep.count);
+    timeRotation->setRetention(retention);
+    RotationStrategyPtr logRotation = timeRotation;
+
+    if (sizeInBytesToRotateAfter.size > 0) {
+        QSharedPointer<SizeRotationStrategy> sizeRotation(new SizeRotationStrategy);
+        sizeRotation->setMaximumSizeInBytes(sizeInBytesToRotateAfter.size);
+        QSharedPointer<CompositeRotationStrategy> composite(new CompositeRotationStrategy);
+        composite->addStrategy(timeRotation);
+        composite->addStrategy(sizeRotation);
+        logRotation = composite;
+    }
+
+    return DestinationPtr(new FileDestination(filePath, logRotation, MakeLayout(format), policy,
+                                              MakeFileWriter(backend)));
+}
+
+DestinationPtr DestinationFactory::MakeBinaryFileDestination(const QString& filePath)
+{
+    return DestinationPtr(new BinaryFileDestination(filePath));
+}
+
+DestinationPtr DestinationFactory::MakeRingFileDestination(const QString& filePath,
+    const MaxSizeBytes &fileSize, LogFormat format)
+{
+    return DestinationPtr(new RingFileDestination(filePath, fileSize.size, MakeLayout(format)));
+}
+
+DestinationPtr DestinationFactory::MakeFlightRecorderDestination(DestinationPtr target, int capacity)
+{
+    return DestinationPtr(new FlightRecorderDestination(target, capacity));
 }
 
-DestinationPtr DestinationFactory::MakeDebugOutputDestination()
+DestinationPtr DestinationFactory::MakeDebugOutputDestination(LogFormat format)
 {
-    return DestinationPtr(new DebugOutputDestination);
+    return DestinationPtr(new DebugOutputDestination(MakeLayout(format)));
 }
 
 DestinationPtr DestinationFactory::MakeFunctorDestination(QsLogging::Destination::LogFunction f)
@@ -27,19 +27,14 @@
 #define QSLOGDEST_H
 
 #include "QsLogLevel.h"
+#include "QsLogMessage.h"
+#include <QByteArray>
+#include <QList>
 #include <QSharedPointer>
 #include <QtGlobal>
 class QString;
 class QObject;
 
-#ifdef QSLOG_IS_SHARED_LIBRARY
-#define QSLOG_SHARED_OBJECT Q_DECL_EXPORT
-#elif QSLOG_IS_SHARED_LIBRARY_IMPORT
-#define QSLOG_SHARED_OBJECT Q_DECL_IMPORT
-#else
-#define QSLOG_SHARED_OBJECT
-#endif
-
 namespace QsLogging
 {
 
@@ -49,9 +44,47 @@ public:
     typedef void (*LogFunction)(const QString &message, Level level);
 
 public:
+    Destination();
     virtual ~Destination();
+    //! Receives the whole record. The default implementation passes the formatted text on to
+    //! write(), so only destinations that render the structured parts need to override it.
+    virtual void writeMessage(const LogMessage& message);
     virtual void write(const QString& message, Level level) = 0;
     virtual bool isValid() = 0; // returns whether the destination was created correctly
+    //! Pushes buffered messages to their final place. The default implementation does nothing.
+    virtual void flush();
+    //! Makes everything written so far durable, see Logger::setDurableLevel. Called after
+    //! writeMessage without the logger lock, possibly from several threads at once. The default
+    //! implementation does nothing.
+    virtual void commit();
+    //! Records below the logger's level still reach a destination that returns a level at or
+    //! below theirs, e.g. a recorder keeping TRACE in memory. Read when the destination is added;
+    //! the default implementation returns OffLevel.
+    virtual Level captureLevel();
+
+    //! Records below the level skip this destination, which makes it stricter than the logger's
+    //! level, e.g. WARN for the console while the file gets DEBUG. Default is TraceLevel.
+    //! Set it before adding the destination: the logging macros check the lowest level any
+    //! destination takes, computed when destinations are added and the logger's level changes.
+    void setLevel(Level level);
+    Level level() const { return mLevel; }
+    //! Only records of these categories and the categories below them pass ("net" passes
+    //! "net.http"), an empty name stands for records without a category. Empty by default,
+    //! which passes all records.
+    void setCategories(const QList<QByteArray>& categories);
+    QList<QByteArray> categories() const { return mCategories; }
+    bool acceptsCategory(const QByteArray& category) const
+    {
+        return mCategories.isEmpty() || matchesCategory(category);
+    }
+    //! true for the category 'name' and the categories below it
+    static bool categoryBelongsTo(const QByteArray& category, const QByteArray& name);
+
+private:
+    bool matchesCategory(const QByteArray& category) const;
+
+    Level mLevel;
+    QList<QByteArray> mCategories;
 };
 typedef QSharedPointer<Destination> DestinationPtr;
 
@@ -60,7 +93,39 @@ typedef QSharedPointer<Destination> DestinationPtr;
 enum LogRotationOption
 {
     DisableLogRotation = 0,
-    EnableLogRotation  = 1
+    EnableLogRotation  = 1,
+    // backups named filename.000001 and up, the old log count isn't limited to 10 and
+    // a RetentionPolicy can limit their total size and age
+    EnableSequencedLogRotation = 2,
+    // backups gzip-compressed in the background and kept while their compressed total stays
+    // within old log count * size
+    EnableCompressedLogRotation = 3,
+    // like EnableLogRotation for a file several processes log to: one of them rotates, the others
+    // reopen. Always uses NativeFileBackend; elsewhere than on Unix it is EnableLogRotation.
+    EnableSharedLogRotation = 4
+};
+
+enum LogFormat
+{
+    PlainTextFormat = 0,
+    JsonLinesFormat = 1
+};
+
+//! How the file destination talks to the file. NativeFileBackend writes through a buffered raw
+//! descriptor, MappedFileBackend copies into a memory mapping of the file and, with the default
+//! FlushPolicy, flushes it every second instead of after each message. Both fall back to
+//! QtFileBackend on platforms that don't support them. IoUringFileBackend submits batches
+//! asynchronously on Linux and falls back to NativeFileBackend where the kernel or its headers
+//! lack io_uring; pair it with a FlushPolicy that doesn't flush every message.
+//! CompressedFileBackend writes the log as gzip members, one per flush; name the file .gz and
+//! batch the flushes as well. Its rotation size limit applies to the compressed file.
+enum FileBackend
+{
+    QtFileBackend = 0,
+    NativeFileBackend = 1,
+    MappedFileBackend = 2,
+    IoUringFileBackend = 3,
+    CompressedFileBackend = 4
 };
 
 struct QSLOG_SHARED_OBJECT MaxSizeBytes
@@ -77,6 +142,40 @@ struct QSLOG_SHARED_OBJECT MaxOldLogCount
     int count;
 };
 
+//! Limits for the backups of sequenced and timed rotation, on top of the old log count. The
+//! oldest backups go first; 0 disables a limit.
+struct QSLOG_SHARED_OBJECT RetentionPolicy
+{
+    RetentionPolicy() : maxBytes(0), maxAgeSeconds(0) {}
+
+    qint64 maxBytes;   // all backups together
+    int maxAgeSeconds; // checked at least hourly
+};
+
+struct QSLOG_SHARED_OBJECT RotationIntervalSeconds
+{
+    RotationIntervalSeconds() : seconds(3600) {}
+    explicit RotationIntervalSeconds(int seconds_) : seconds(seconds_) {}
+    int seconds;
+};
+
+//! Decides when the file destination hands buffered messages to the OS. A flush happens as soon as
+//! one of the enabled limits is reached; a limit of 0 is disabled. FATAL messages, destroying the
+//! destination and Logger::flush always flush. The default flushes after every message.
+struct QSLOG_SHARED_OBJECT FlushPolicy
+{
+    FlushPolicy() : messages(1), bytes(0), intervalMs(0), level(FatalLevel) {}
+
+    static FlushPolicy everyMessage() { return FlushPolicy(); }
+    //! only FATAL messages and explicit Logger::flush calls flush
+    static FlushPolicy manual() { FlushPolicy p; p.messages = 0; return p; }
+
+    int messages;     // after this many messages
+    qint64 bytes;     // after this much text
+    int intervalMs;   // when the oldest unflushed message is this old, checked in the background
+    Level level;      // immediately for messages at or above this level
+};
+
 
 //! Creates logging destinations/sinks. The caller shares ownership of the destinations with the logger.
 //! After being added to a logger, the caller can discard the pointers.
@@ -86,8 +185,31 @@ public:
     static DestinationPtr MakeFileDestination(const QString& filePath,
         LogRotationOption rotation = DisableLogRotation,
         const MaxSizeBytes &sizeInBytesToRotateAfter = MaxSizeBytes(),
-        const MaxOldLogCount &oldLogsToKeep = MaxOldLogCount());
-    static DestinationPtr MakeDebugOutputDestination();
+        const MaxOldLogCount &oldLogsToKeep = MaxOldLogCount(),
+        LogFormat format = PlainTextFormat,
+        const FlushPolicy &flushPolicy = FlushPolicy(),
+        FileBackend backend = QtFileBackend,
+        const RetentionPolicy &retention = RetentionPolicy());
+    //! Rotates at multiples of the interval from local midnight, and at the size too unless it is 0.
+    //! Backups are named after their period, e.g. log.txt.20240131-1400.
+    static DestinationPtr MakeTimedFileDestination(const QString& filePath,
+        const RotationIntervalSeconds &interval = RotationIntervalSeconds(),
+        const MaxSizeBytes &sizeInBytesToRotateAfter = MaxSizeBytes(),
+        const MaxOldLogCount &oldLogsToKeep = MaxOldLogCount(),
+        LogFormat format = PlainTextFormat,
+        const FlushPolicy &flushPolicy = FlushPolicy(),
+        FileBackend backend = QtFileBackend,
+        const RetentionPolicy &retention = RetentionPolicy());
+    //! compact binary log, read it with the qslog-decode tool
+    static DestinationPtr MakeBinaryFileDestination(const QString& filePath);
+    //! fixed-size file used as a ring that keeps the newest messages, read it with qslog-decode
+    static DestinationPtr MakeRingFileDestination(const QString& filePath,
+        const MaxSizeBytes &fileSize = MaxSizeBytes(16 * 1024 * 1024),
+        LogFormat format = PlainTextFormat);
+    //! Keeps the last 'capacity' records of all levels in memory and writes them to 'target'
+    //! when an error is logged, see FlightRecorderDestination.
+    static DestinationPtr MakeFlightRecorderDestination(DestinationPtr target, int capacity = 4096);
+    static DestinationPtr MakeDebugOutputDestination(LogFormat format = PlainTextFormat);
     // takes a pointer to a function
     static DestinationPtr MakeFunctorDestination(Destination::LogFunction f);
     // takes a QObject + signal/slot
@@ -0,0 +1,429 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLogDestBinary.h"
+#include <QDateTime>
+#include <QMetaType>
+#include <QVarLengthArray>
+#include <QtEndian>
+#include <QtGlobal>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+const char SegmentMagic[] = { 'Q', 'S', 'L', 'B' };
+const int SegmentMagicSize = sizeof(SegmentMagic);
+const char FormatVersion = 1;
+
+enum EntryTag
+{
+    DictionaryEntry = 1,
+    RecordEntry = 2,
+    ThreadEntry = 3
+};
+
+enum FieldType
+{
+    NullField = 0,
+    BoolField,
+    IntField,
+    UIntField,
+    DoubleField,
+    StringField
+};
+
+void appendVarint(QByteArray& out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+quint64 zigZagEncode(qint64 value)
+{
+    return (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63);
+}
+
+qint64 zigZagDecode(quint64 value)
+{
+    return static_cast<qint64>(value >> 1) ^ -static_cast<qint64>(value & 1);
+}
+
+void appendFieldValue(QByteArray& out, const QVariant& value)
+{
+    switch (value.userType()) {
+        case QMetaType::UnknownType:
+            out.append(static_cast<char>(NullField));
+            break;
+        case QMetaType::Bool:
+            out.append(static_cast<char>(BoolField));
+            out.append(static_cast<char>(value.toBool() ? 1 : 0));
+            break;
+        case QMetaType::Int:
+        case QMetaType::Long:
+        case QMetaType::Short:
+        case QMetaType::LongLong:
+            out.append(static_cast<char>(IntField));
+            appendVarint(out, zigZagEncode(value.toLongLong()));
+            break;
+        case QMetaType::UInt:
+        case QMetaType::ULong:
+        case QMetaType::UShort:
+        case QMetaType::ULongLong:
+            out.append(static_cast<char>(UIntField));
+            appendVarint(out, value.toULongLong());
+            break;
+        case QMetaType::Float:
+        case QMetaType::Double: {
+            const double d = value.toDouble();
+            quint64 bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            uchar raw[sizeof(bits)];
+            qToLittleEndian(bits, raw);
+            out.append(static_cast<char>(DoubleField));
+            out.append(reinterpret_cast<const char*>(raw), sizeof(raw));
+            break;
+        }
+        default: {
+            const QByteArray text = value.toString().toUtf8();
+            out.append(static_cast<char>(StringField));
+            appendVarint(out, text.size());
+            out.append(text);
+            break;
+        }
+    }
+}
+}
+
+QsLogging::BinaryFileDestination::BinaryFileDestination(const QString& filePath)
+    : mThreadEntryCount(0)
+    , mLastTimestamp(0)
+{
+    // reserved capacity survives resize(0), so the buffer is allocated only once
+    mBuffer.reserve(512);
+    mFile.setFileName(filePath);
+    if (!mFile.open(QFile::WriteOnly | QFile::Append))
+        std::cerr << "QsLog: could not open log file " << qPrintable(filePath);
+    startSegment();
+}
+
+void QsLogging::BinaryFileDestination::startSegment()
+{
+    mDictionary.clear();
+    mCallSites.clear();
+    mThreads.clear();
+    mThreadEntryCount = 0;
+    mLastTimestamp = 0;
+    mBuffer.append(SegmentMagic, SegmentMagicSize);
+    mBuffer.append(FormatVersion);
+}
+
+quint32 QsLogging::BinaryFileDestination::dictionaryId(const QByteArray& text)
+{
+    QHash<QByteArray, quint32>::const_iterator it = mDictionary.constFind(text);
+    if (it != mDictionary.constEnd())
+        return it.value();
+
+    // ids are implicit: the n-th definition in a segment has id n
+    const quint32 id = mDictionary.size() + 1;
+    mDictionary.insert(text, id);
+    mBuffer.append(static_cast<char>(DictionaryEntry));
+    appendVarint(mBuffer, text.size());
+    mBuffer.append(text);
+    return id;
+}
+
+quint32 QsLogging::BinaryFileDestination::threadEntryId(const LogMessage& message)
+{
+    if (!message.threadId)
+        return 0;
+
+    QHash<quint64, QPair<QString, quint32> >::const_iterator it = mThreads.constFind(message.threadId);
+    if (it != mThreads.constEnd() && it.value().first == message.threadName)
+        return it.value().second;
+
+    // new thread or renamed thread: (re)define it, ids are implicit like for the dictionary
+    const quint32 id = ++mThreadEntryCount;
+    mThreads.insert(message.threadId, qMakePair(message.threadName, id));
+    const QByteArray name = message.threadName.toUtf8();
+    mBuffer.append(static_cast<char>(ThreadEntry));
+    appendVarint(mBuffer, message.threadId);
+    appendVarint(mBuffer, name.size());
+    mBuffer.append(name);
+    return id;
+}
+
+void QsLogging::BinaryFileDestination::writeMessage(const LogMessage& message)
+{
+    // context fields first, then the record's own fields
+    const LogFieldList contextFields = message.contextFields();
+    QVarLengthArray<quint32, 8> keyIds;
+    for (int i = 0;i < contextFields.size();++i)
+        keyIds.append(dictionaryId(contextFields.at(i).key));
+    for (int i = 0;i < message.fields.size();++i)
+        keyIds.append(dictionaryId(message.fields.at(i).key));
+
+    const quint32 thread = threadEntryId(message);
+    // call-site 0 means the record carries no source location. Locations are string literals,
+    // so the pointer identifies the call site without hashing the text.
+    quint32 callSite = 0;
+    if (message.location) {
+        QHash<const char*, quint32>::const_iterator it = mCallSites.constFind(message.location);
+        if (it != mCallSites.constEnd()) {
+            callSite = it.value();
+        } else {
+            callSite = dictionaryId(QByteArray(message.location));
+            mCallSites.insert(message.location, callSite);
+        }
+    }
+    const quint32 category = message.category.isEmpty() ? 0 : dictionaryId(message.category);
+    const QByteArray text = message.message.toUtf8();
+
+    mBuffer.append(static_cast<char>(RecordEntry));
+    appendVarint(mBuffer, zigZagEncode(message.timestamp - mLastTimestamp));
+    mLastTimestamp = message.timestamp;
+    mBuffer.append(static_cast<char>(message.level));
+    appendVarint(mBuffer, thread);
+    appendVarint(mBuffer, callSite);
+    appendVarint(mBuffer, category);
+    appendVarint(mBuffer, text.size());
+    mBuffer.append(text);
+    appendVarint(mBuffer, contextFields.size());
+    for (int i = 0;i < contextFields.size();++i) {
+        appendVarint(mBuffer, keyIds[i]);
+        appendFieldValue(mBuffer, contextFields.at(i).value);
+    }
+    appendVarint(mBuffer, message.fields.size());
+    for (int i = 0;i < message.fields.size();++i) {
+        appendVarint(mBuffer, keyIds[contextFields.size() + i]);
+        appendFieldValue(mBuffer, message.fields.at(i).value);
+    }
+
+    if (mFile.write(mBuffer) != mBuffer.size())
+        std::cerr << "QsLog: could not write to log file " << qPrintable(mFile.fileName());
+    mFile.flush();
+    mBuffer.resize(0);
+}
+
+void QsLogging::BinaryFileDestination::write(const QString& message, Level level)
+{
+    writeMessage(LogMessage(message, level, QDateTime::currentMSecsSinceEpoch()));
+}
+
+bool QsLogging::BinaryFileDestination::isValid()
+{
+    return mFile.isOpen();
+}
+
+
+QsLogging::BinaryLogReader::BinaryLogReader(const QByteArray& data)
+    : mData(data)
+    , mPos(0)
+    , mError(false)
+    , mLastTimestamp(0)
+{
+}
+
+bool QsLogging::BinaryLogReader::readNext(LogMessage& message)
+{
+    while (!mError && mPos < mData.size()) {
+        // a new segment starts every time the writer opened the file
+        if (mData.size() - mPos >= SegmentMagicSize
+            && !std::memcmp(mData.constData() + mPos, SegmentMagic, SegmentMagicSize)) {
+            mPos += SegmentMagicSize;
+            if (mPos >= mData.size() || mData.at(mPos) != FormatVersion) {
+                mError = true;
+                return false;
+            }
+            ++mPos;
+            mDictionary.clear();
+            mThreads.clear();
+            mLastTimestamp = 0;
+            continue;
+        }
+
+        const char tag = mData.at(mPos++);
+        if (DictionaryEntry == tag) {
+            quint64 size = 0;
+            QByteArray text;
+            if (!readVarint(size) || !readBytes(static_cast<int>(qMin<quint64>(size, INT_MAX)), text)) {
+                mError = true;
+                return false;
+            }
+            mDictionary.append(text);
+            mRetainedStrings.append(text);
+            continue;
+        }
+        if (ThreadEntry == tag) {
+            quint64 threadId = 0, size = 0;
+            QByteArray name;
+            if (!readVarint(threadId) || !readVarint(size)
+                || !readBytes(static_cast<int>(qMin<quint64>(size, INT_MAX)), name)) {
+                mError = true;
+                return false;
+            }
+            mThreads.append(qMakePair(threadId, QString::fromUtf8(name)));
+            continue;
+        }
+
+        quint64 delta = 0, thread = 0, callSite = 0, category = 0, textSize = 0;
+        quint64 contextCount = 0, fieldCount = 0;
+        QByteArray text;
+        if (RecordEntry != tag || !readVarint(delta) || mPos >= mData.size()) {
+            mError = true;
+            return false;
+        }
+        const int level = mData.at(mPos++);
+        if (level < TraceLevel || level > FatalLevel
+            || !readVarint(thread) || thread > static_cast<quint64>(mThreads.size())
+            || !readVarint(callSite) || callSite > static_cast<quint64>(mDictionary.size())
+            || !readVarint(category) || category > static_cast<quint64>(mDictionary.size())
+            || !readVarint(textSize)
+            || !readBytes(static_cast<int>(qMin<quint64>(textSize, INT_MAX)), text)
+            || !readVarint(contextCount)) {
+            mError = true;
+            return false;
+        }
+
+        mLastTimestamp += zigZagDecode(delta);
+        message = LogMessage(QString::fromUtf8(text), static_cast<Level>(level), mLastTimestamp);
+        if (callSite)
+            message.location = mDictionary.at(static_cast<int>(callSite - 1)).constData();
+        if (category)
+            message.category = mDictionary.at(static_cast<int>(category - 1));
+        if (thread) {
+            message.threadId = mThreads.at(static_cast<int>(thread - 1)).first;
+            message.threadName = mThreads.at(static_cast<int>(thread - 1)).second;
+        }
+        for (quint64 i = 0;i < contextCount;++i) {
+            LogField field;
+            if (!readField(field)) {
+                mError = true;
+                return false;
+            }
+            message.context = LogContextPtr(new LogContext(field, message.context));
+        }
+        if (!readVarint(fieldCount)) {
+            mError = true;
+            return false;
+        }
+        for (quint64 i = 0;i < fieldCount;++i) {
+            LogField field;
+            if (!readField(field)) {
+                mError = true;
+                return false;
+            }
+            message.fields.append(field);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool QsLogging::BinaryLogReader::hasError() const
+{
+    return mError;
+}
+
+bool QsLogging::BinaryLogReader::readVarint(quint64& value)
+{
+    value = 0;
+    for (int shift = 0;shift < 64 && mPos < mData.size();shift += 7) {
+        const uchar byte = static_cast<uchar>(mData.at(mPos++));
+        value |= static_cast<quint64>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool QsLogging::BinaryLogReader::readBytes(int size, QByteArray& bytes)
+{
+    if (size > mData.size() - mPos)
+        return false;
+    bytes = mData.mid(mPos, size);
+    mPos += size;
+    return true;
+}
+
+bool QsLogging::BinaryLogReader::readField(LogField& field)
+{
+    quint64 keyId = 0;
+    if (!readVarint(keyId) || keyId < 1 || keyId > static_cast<quint64>(mDictionary.size())
+        || mPos >= mData.size())
+        return false;
+    field.key = mDictionary.at(static_cast<int>(keyId - 1));
+
+    const char type = mData.at(mPos++);
+    switch (type) {
+        case NullField:
+            field.value = QVariant();
+            return true;
+        case BoolField:
+            if (mPos >= mData.size())
+                return false;
+            field.value = QVariant(mData.at(mPos++) != 0);
+            return true;
+        case IntField: {
+            quint64 raw = 0;
+            if (!readVarint(raw))
+                return false;
+            field.value = QVariant(static_cast<qlonglong>(zigZagDecode(raw)));
+            return true;
+        }
+        case UIntField: {
+            quint64 raw = 0;
+            if (!readVarint(raw))
+                return false;
+            field.value = QVariant(static_cast<qulonglong>(raw));
+            return true;
+        }
+        case DoubleField: {
+            QByteArray raw;
+            if (!readBytes(sizeof(quint64), raw))
+                return false;
+            const quint64 bits = qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(raw.constData()));
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            field.value = QVariant(d);
+            return true;
+        }
+        case StringField: {
+            quint64 size = 0;
+            QByteArray text;
+            if (!readVarint(size) || !readBytes(static_cast<int>(qMin<quint64>(size, INT_MAX)), text))
+                return false;
+            field.value = QVariant(QString::fromUtf8(text));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGDESTBINARY_H
+#define QSLOGDESTBINARY_H
+
+#include "QsLogDest.h"
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QVector>
+#include <QtGlobal>
+
+namespace QsLogging
+{
+// Compact binary file sink. Every time the file is opened a segment header is written, followed
+// by records made of a varint timestamp delta, the level, thread, call-site and category ids,
+// the message bytes and the raw context and field values. Strings that repeat (field keys,
+// call sites, categories) and thread identities are stored once per segment in inline
+// dictionaries and referenced by id. Use qslog-decode to turn the file into text.
+class BinaryFileDestination : public Destination
+{
+public:
+    explicit BinaryFileDestination(const QString& filePath);
+    void writeMessage(const LogMessage& message) override;
+    void write(const QString& message, Level level) override;
+    bool isValid() override;
+
+private:
+    void startSegment();
+    quint32 dictionaryId(const QByteArray& text);
+    quint32 threadEntryId(const LogMessage& message);
+
+    QFile mFile;
+    QByteArray mBuffer;
+    QHash<QByteArray, quint32> mDictionary;
+    QHash<const char*, quint32> mCallSites;
+    QHash<quint64, QPair<QString, quint32> > mThreads;
+    quint32 mThreadEntryCount;
+    qint64 mLastTimestamp;
+};
+
+// Reads back records written by BinaryFileDestination.
+class BinaryLogReader
+{
+public:
+    explicit BinaryLogReader(const QByteArray& data);
+
+    //! Returns false at the end of the data or at the first truncated or corrupt entry.
+    bool readNext(LogMessage& message);
+    //! True if reading stopped before the end of the data.
+    bool hasError() const;
+
+private:
+    bool readVarint(quint64& value);
+    bool readBytes(int size, QByteArray& bytes);
+    bool readField(LogField& field);
+
+    QByteArray mData;
+    int mPos;
+    bool mError;
+    QVector<QByteArray> mDictionary;
+    QList<QByteArray> mRetainedStrings; // keeps LogMessage::location valid across segments
+    QVector<QPair<quint64, QString> > mThreads;
+    qint64 mLastTimestamp;
+};
+
+}
+
+#endif // QSLOGDESTBINARY_H
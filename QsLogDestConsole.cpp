@@ -44,6 +44,16 @@ void QsDebugOutput::output( const QString& message )
 }
 #endif
 
+QsLogging::DebugOutputDestination::DebugOutputDestination(LayoutPtr layout)
+    : mLayout(layout)
+{
+}
+
+void QsLogging::DebugOutputDestination::writeMessage(const LogMessage& message)
+{
+    QsDebugOutput::output(mLayout->format(message));
+}
+
 void QsLogging::DebugOutputDestination::write(const QString& message, Level)
 {
     QsDebugOutput::output(message);
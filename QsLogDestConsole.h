@@ -27,6 +27,7 @@
 #define QSLOGDESTCONSOLE_H
 
 #include "QsLogDest.h"
+#include "QsLogLayout.h"
 
 class QString;
 
@@ -43,8 +44,13 @@ namespace QsLogging
 class DebugOutputDestination : public Destination
 {
 public:
+    explicit DebugOutputDestination(LayoutPtr layout = LayoutPtr(new TextLayout));
+    void writeMessage(const LogMessage& message) override;
     void write(const QString& message, Level level) override;
     bool isValid() override;
+
+private:
+    LayoutPtr mLayout;
 };
 
 }
@@ -24,17 +24,25 @@
 // OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "QsLogDestFile.h"
-#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
-#include <QTextCodec>
-#endif
+#include "QsLogCompression.h"
 #include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QPair>
+#include <QRegularExpression>
+#include <QThread>
+#include <QWaitCondition>
 #include <QtGlobal>
+#include <algorithm>
 #include <iostream>
-
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-namespace Qt {
-static const QTextStreamFunction endl = ::endl;
-}
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 const int QsLogging::SizeRotationStrategy::MaxBackupCount = 10;
@@ -43,22 +51,38 @@ QsLogging::RotationStrategy::~RotationStrategy()
 {
 }
 
+void QsLogging::RotationStrategy::beforeOpen(const QString&)
+{
+}
+
+void QsLogging::RotationStrategy::setMessageTime(qint64)
+{
+}
+
+void QsLogging::RotationStrategy::maintain()
+{
+}
+
 QsLogging::SizeRotationStrategy::SizeRotationStrategy()
     : mCurrentSizeInBytes(0)
     , mMaxSizeInBytes(0)
     , mBackupsCount(0)
+    , mCompressBackups(false)
+    , mLastPending(0)
 {
 }
 
 void QsLogging::SizeRotationStrategy::setInitialInfo(const QFile &file)
 {
-    mFileName = file.fileName();
+    // reopening after a rotation gives the same name, maintain() may be reading it
+    if (mFileName != file.fileName())
+        mFileName = file.fileName();
     mCurrentSizeInBytes = file.size();
 }
 
-void QsLogging::SizeRotationStrategy::includeMessageInCalculation(const QString &message)
+void QsLogging::SizeRotationStrategy::includeMessageInCalculation(qint64 sizeInBytes)
 {
-    mCurrentSizeInBytes += message.toUtf8().size();
+    mCurrentSizeInBytes += sizeInBytes;
 }
 
 bool QsLogging::SizeRotationStrategy::shouldRotate()
@@ -66,8 +90,6 @@ bool QsLogging::SizeRotationStrategy::shouldRotate()
     return mCurrentSizeInBytes > mMaxSizeInBytes;
 }
 
-// Algorithm assumes backups will be named filename.X, where 1 <= X <= mBackupsCount.
-// All X's will be shifted up.
 void QsLogging::SizeRotationStrategy::rotate()
 {
     if (!mBackupsCount) {
@@ -76,8 +98,71 @@ void QsLogging::SizeRotationStrategy::rotate()
         return;
     }
 
+    // A name of its own, so maintenance still busy with earlier rotations is never in the way.
+    // N starts from the time to stay in order across runs.
+    quint64 pending = qMax<quint64>(mLastPending + 1, QDateTime::currentMSecsSinceEpoch());
+    QString newName = mFileName + QString::fromUtf8(".0.%1").arg(pending);
+    while (QFile::exists(newName))
+        newName = mFileName + QString::fromUtf8(".0.%1").arg(++pending);
+    mLastPending = pending;
+    if (!QFile::rename(mFileName, newName)) {
+        std::cerr << "QsLog: could not rename log " << qPrintable(mFileName)
+                  << " to " << qPrintable(newName);
+    }
+}
+
+// Moves each pending filename.0.N to filename.0 and shifts it into the backups.
+void QsLogging::SizeRotationStrategy::maintain()
+{
+    if (!mBackupsCount)
+        return;
+
+    const QString logNamePattern = mFileName + QString::fromUtf8(".%1");
+    const QString rotatedName = logNamePattern.arg(0);
+    QStringList pending = pendingBackups();
+    // left by an interrupted shift or by an earlier version, older than the pending files
+    if (QFile::exists(rotatedName))
+        pending.prepend(rotatedName);
+    Q_FOREACH (const QString& pendingName, pending) {
+        if (pendingName != rotatedName && !QFile::rename(pendingName, rotatedName)) {
+            std::cerr << "QsLog: could not rename log " << qPrintable(pendingName)
+                      << " to " << qPrintable(rotatedName);
+            return;
+        }
+        if (mCompressBackups)
+            maintainCompressed(logNamePattern);
+        else
+            shiftBackups(logNamePattern);
+    }
+}
+
+// the filename.0.N files, oldest first
+QStringList QsLogging::SizeRotationStrategy::pendingBackups() const
+{
+    const QFileInfo info(mFileName);
+    const QString prefix = info.fileName() + QString::fromUtf8(".0.");
+    QList<quint64> numbers;
+    Q_FOREACH (const QString& name, info.dir().entryList(QStringList(prefix + QLatin1Char('*')), QDir::Files)) {
+        bool isNumber = false;
+        const quint64 number = name.mid(prefix.size()).toULongLong(&isNumber);
+        if (isNumber)
+            numbers.append(number);
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    QStringList filePaths;
+    Q_FOREACH (quint64 number, numbers)
+        filePaths.append(mFileName + QString::fromUtf8(".0.%1").arg(number));
+    return filePaths;
+}
+
+// Algorithm assumes backups will be named filename.X, where 1 <= X <= mBackupsCount.
+// All X's will be shifted up and filename.0 becomes filename.1.
+void QsLogging::SizeRotationStrategy::shiftBackups(const QString& logNamePattern)
+{
+    const QString rotatedName = logNamePattern.arg(0);
+
      // 1. find the last existing backup than can be shifted up
-     const QString logNamePattern = mFileName + QString::fromUtf8(".%1");
      int lastExistingBackupIndex = 0;
      for (int i = 1;i <= mBackupsCount;++i) {
          const QString backupFileName = logNamePattern.arg(i);
@@ -99,12 +184,12 @@ void QsLogging::SizeRotationStrategy::rotate()
          }
      }
 
-     // 3. rename current log file
+     // 3. rename the rotated log file
      const QString newName = logNamePattern.arg(1);
      if (QFile::exists(newName))
          QFile::remove(newName);
-     if (!QFile::rename(mFileName, newName)) {
-         std::cerr << "QsLog: could not rename log " << qPrintable(mFileName)
+     if (!QFile::rename(rotatedName, newName)) {
+         std::cerr << "QsLog: could not rename log " << qPrintable(rotatedName)
                    << " to " << qPrintable(newName);
      }
 }
@@ -123,43 +208,992 @@ void QsLogging::SizeRotationStrategy::setMaximumSizeInBytes(qint64 size)
 void QsLogging::SizeRotationStrategy::setBackupCount(int backups)
 {
     Q_ASSERT(backups >= 0);
+    if (backups > SizeRotationStrategy::MaxBackupCount) {
+        std::cerr << "QsLog: keeping " << SizeRotationStrategy::MaxBackupCount
+                  << " backups, use sequenced rotation for more";
+    }
     mBackupsCount = qMin(backups, SizeRotationStrategy::MaxBackupCount);
 }
 
+void QsLogging::SizeRotationStrategy::setCompressBackups(bool compress)
+{
+    mCompressBackups = compress;
+}
+
+// Like the uncompressed case, but the number of backups follows from the size budget. A backup
+// whose compression was interrupted is still plain and gets compressed on the next run.
+void QsLogging::SizeRotationStrategy::maintainCompressed(const QString& logNamePattern)
+{
+    const QString compressedPattern = logNamePattern + QString::fromUtf8(".gz");
+
+    // 1. shift everything up, filename.0 becomes filename.1
+    int lastIndex = 0;
+    while (QFile::exists(logNamePattern.arg(lastIndex + 1))
+           || QFile::exists(compressedPattern.arg(lastIndex + 1)))
+        ++lastIndex;
+    for (int i = lastIndex; i >= 0; --i) {
+        const QString names[2] = { logNamePattern, compressedPattern };
+        for (int k = 0; k < 2; ++k) {
+            const QString oldName = names[k].arg(i);
+            const QString newName = names[k].arg(i + 1);
+            if (QFile::exists(oldName) && !QFile::rename(oldName, newName)) {
+                std::cerr << "QsLog: could not rename backup " << qPrintable(oldName)
+                          << " to " << qPrintable(newName);
+            }
+        }
+    }
+    ++lastIndex;
+
+    // 2. compress and drop what no longer fits, always keeping the newest backup
+    const qint64 budget = static_cast<qint64>(mBackupsCount) * mMaxSizeInBytes;
+    qint64 total = 0;
+    for (int i = 1; i <= lastIndex; ++i) {
+        const QString plainName = logNamePattern.arg(i);
+        const QString compressedName = compressedPattern.arg(i);
+        if (total > budget) {
+            QFile::remove(plainName);
+            QFile::remove(compressedName);
+            continue;
+        }
+        if (QFile::exists(plainName))
+            GzipFile(plainName, compressedName);
+        total += QFileInfo(QFile::exists(compressedName) ? compressedName : plainName).size();
+        if (total > budget && i > 1) {
+            QFile::remove(plainName);
+            QFile::remove(compressedName);
+        }
+    }
+}
+
+
+QsLogging::TimeRotationStrategy::TimeRotationStrategy()
+    : mIntervalSeconds(3600)
+    , mMessageTime(0)
+    , mPeriodStart(0)
+    , mNextBoundary(0)
+    , mScanned(false)
+{
+}
+
+// A file that already has content belongs to the period it was last written in, so the first
+// message of a later period rotates it.
+void QsLogging::TimeRotationStrategy::setInitialInfo(const QFile &file)
+{
+    // reopening after a rotation gives the same name, maintain() may be reading it
+    if (mFileName != file.fileName())
+        mFileName = file.fileName();
+    if (file.size() > 0)
+        computePeriod(QFileInfo(file).lastModified().toMSecsSinceEpoch());
+    else
+        computePeriod(mMessageTime ? mMessageTime : QDateTime::currentMSecsSinceEpoch());
+}
+
+void QsLogging::TimeRotationStrategy::setMessageTime(qint64 timestamp)
+{
+    mMessageTime = timestamp;
+}
+
+bool QsLogging::TimeRotationStrategy::shouldRotate()
+{
+    return mMessageTime >= mNextBoundary;
+}
+
+void QsLogging::TimeRotationStrategy::rotate()
+{
+    if (mSweeper.keepsNone()) {
+        if (!QFile::remove(mFileName))
+            std::cerr << "QsLog: backup delete failed " << qPrintable(mFileName);
+        return;
+    }
+
+    QMutexLocker lock(&mMutex);
+    if (!mScanned)
+        scanBackups();
+    const QString periodName = mFileName + QLatin1Char('.')
+        + QDateTime::fromMSecsSinceEpoch(mPeriodStart).toString(QString::fromUtf8("yyyyMMdd-HHmm"));
+    // more than one file per period only happens together with another strategy
+    QString newName = periodName;
+    for (int i = 1; QFile::exists(newName); ++i)
+        newName = periodName + QString::fromUtf8(".%1").arg(i);
+    if (!QFile::rename(mFileName, newName)) {
+        std::cerr << "QsLog: could not rename log " << qPrintable(mFileName)
+                  << " to " << qPrintable(newName);
+        return;
+    }
+    mNewBackups.append(newName);
+}
+
+QIODevice::OpenMode QsLogging::TimeRotationStrategy::recommendedOpenModeFlag()
+{
+    return QIODevice::Append;
+}
+
+void QsLogging::TimeRotationStrategy::maintain()
+{
+    QStringList newBackups;
+    {
+        QMutexLocker lock(&mMutex);
+        if (!mScanned)
+            scanBackups();
+        newBackups.swap(mNewBackups);
+    }
+    Q_FOREACH (const QString& filePath, newBackups)
+        mSweeper.add(filePath);
+    mSweeper.sweep();
+}
+
+void QsLogging::TimeRotationStrategy::setIntervalInSeconds(int seconds)
+{
+    Q_ASSERT(seconds > 0);
+    mIntervalSeconds = seconds;
+}
+
+void QsLogging::TimeRotationStrategy::setBackupCount(int backups)
+{
+    Q_ASSERT(backups >= 0);
+    mSweeper.setMaximumCount(backups);
+}
+
+void QsLogging::TimeRotationStrategy::setRetention(const RetentionPolicy& retention)
+{
+    mSweeper.setRetention(retention);
+}
+
+void QsLogging::TimeRotationStrategy::computePeriod(qint64 time)
+{
+    static const int SecondsPerDay = 24 * 60 * 60;
+    const QDateTime local = QDateTime::fromMSecsSinceEpoch(time);
+    const QDateTime midnight(local.date(), QTime(0, 0));
+    QDateTime start = midnight;
+    QDateTime next;
+    if (mIntervalSeconds >= SecondsPerDay) {
+        next = midnight.addDays(mIntervalSeconds / SecondsPerDay);
+    } else {
+        const qint64 periods = midnight.secsTo(local) / mIntervalSeconds;
+        start = midnight.addSecs(periods * mIntervalSeconds);
+        // the last period of a day ends at midnight even if the interval doesn't divide the day
+        next = qMin(start.addSecs(mIntervalSeconds), midnight.addDays(1));
+    }
+    mPeriodStart = start.toMSecsSinceEpoch();
+    mNextBoundary = next.toMSecsSinceEpoch();
+}
+
+void QsLogging::TimeRotationStrategy::scanBackups()
+{
+    const QFileInfo info(mFileName);
+    const QString prefix = info.fileName() + QLatin1Char('.');
+    const QRegularExpression backupPattern(QString::fromUtf8("^\\d{8}-\\d{4}(?:\\.(\\d+))?$"));
+    QList<QPair<QString, int> > backups;
+    Q_FOREACH (const QString& name, info.dir().entryList(QStringList(prefix + QLatin1Char('*')), QDir::Files)) {
+        const QString suffix = name.mid(prefix.size());
+        const QRegularExpressionMatch match = backupPattern.match(suffix);
+        if (match.hasMatch())
+            backups.append(qMakePair(suffix.left(13), match.captured(1).toInt()));
+    }
+    // period first, then the .N suffix numerically
+    std::sort(backups.begin(), backups.end());
+
+    QStringList filePaths;
+    for (int i = 0; i < backups.size(); ++i) {
+        QString name = prefix + backups.at(i).first;
+        if (backups.at(i).second)
+            name += QString::fromUtf8(".%1").arg(backups.at(i).second);
+        filePaths.append(info.dir().filePath(name));
+    }
+    // maintain() passes them to the sweeper, together with what rotate() adds meanwhile
+    mNewBackups = filePaths + mNewBackups;
+    mScanned = true;
+}
+
+void QsLogging::CompositeRotationStrategy::addStrategy(RotationStrategyPtr strategy)
+{
+    mStrategies.append(strategy);
+}
+
+void QsLogging::CompositeRotationStrategy::beforeOpen(const QString& filePath)
+{
+    Q_FOREACH (const RotationStrategyPtr& strategy, mStrategies)
+        strategy->beforeOpen(filePath);
+}
+
+void QsLogging::CompositeRotationStrategy::setInitialInfo(const QFile &file)
+{
+    Q_FOREACH (const RotationStrategyPtr& strategy, mStrategies)
+        strategy->setInitialInfo(file);
+}
+
+void QsLogging::CompositeRotationStrategy::setMessageTime(qint64 timestamp)
+{
+    Q_FOREACH (const RotationStrategyPtr& strategy, mStrategies)
+        strategy->setMessageTime(timestamp);
+}
+
+void QsLogging::CompositeRotationStrategy::includeMessageInCalculation(qint64 sizeInBytes)
+{
+    Q_FOREACH (const RotationStrategyPtr& strategy, mStrategies)
+        strategy->includeMessageInCalculation(sizeInBytes);
+}
+
+bool QsLogging::CompositeRotationStrategy::shouldRotate()
+{
+    Q_FOREACH (const RotationStrategyPtr& strategy, mStrategies) {
+        if (strategy->shouldRotate())
+            return true;
+    }
+    return false;
+}
+
+void QsLogging::CompositeRotationStrategy::rotate()
+{
+    if (!mStrategies.isEmpty())
+        mStrategies.first()->rotate();
+}
+
+QIODevice::OpenMode QsLogging::CompositeRotationStrategy::recommendedOpenModeFlag()
+{
+    return mStrategies.isEmpty() ? QIODevice::Append : mStrategies.first()->recommendedOpenModeFlag();
+}
+
+void QsLogging::CompositeRotationStrategy::maintain()
+{
+    if (!mStrategies.isEmpty())
+        mStrategies.first()->maintain();
+}
+
+#ifdef Q_OS_UNIX
+// Layout of filename.lock. A new file is all zeros, which is a valid first generation.
+struct QsLogging::SharedRotationStrategy::SharedState
+{
+    quint32 magic;
+    quint32 version;
+    quint64 generation;
+    qint64 size;
+};
+
+namespace
+{
+const quint32 SharedStateMagic = 0x51534c47; // "QSLG"
+const quint32 SharedStateVersion = 1;
+// the bytes of filename.lock locked for rotating and for maintaining
+const int RotationRange = 0;
+const int MaintenanceRange = 1;
+
+// Atomic operations are atomic between processes only when they are lock-free. Where the 64-bit
+// ones aren't (e.g. ARMv5, libatomic would take locks private to the process), the fields are
+// accessed under the rotation lock instead.
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+static_assert(__atomic_always_lock_free(sizeof(qint64), 0), "shared state needs lock-free atomics");
+const bool SharedStateLockFree = true;
+
+template <typename T>
+T LoadShared(T* value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void StoreShared(T* value, T newValue)
+{
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+template <typename T>
+void AddShared(T* value, T delta)
+{
+    __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+}
+
+template <typename T>
+void RaiseShared(T* value, T newValue)
+{
+    T current = __atomic_load_n(value, __ATOMIC_RELAXED);
+    while (current < newValue
+           && !__atomic_compare_exchange_n(value, &current, newValue, false,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    }
+}
+#else
+const bool SharedStateLockFree = false;
 
-QsLogging::FileDestination::FileDestination(const QString& filePath, RotationStrategyPtr rotationStrategy)
-    : mRotationStrategy(rotationStrategy)
+template <typename T>
+T LoadShared(T* value)
 {
-    mFile.setFileName(filePath);
-    if (!mFile.open(QFile::WriteOnly | QFile::Text | mRotationStrategy->recommendedOpenModeFlag()))
-        std::cerr << "QsLog: could not open log file " << qPrintable(filePath);
-    mOutputStream.setDevice(&mFile);
-#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
-    mOutputStream.setCodec(QTextCodec::codecForName("UTF-8"));
+    return *value;
+}
+
+template <typename T>
+void StoreShared(T* value, T newValue)
+{
+    *value = newValue;
+}
+
+template <typename T>
+void AddShared(T* value, T delta)
+{
+    *value += delta;
+}
+
+template <typename T>
+void RaiseShared(T* value, T newValue)
+{
+    if (*value < newValue)
+        *value = newValue;
+}
 #endif
+}
 
-    mRotationStrategy->setInitialInfo(mFile);
+QsLogging::SharedRotationStrategy::SharedRotationStrategy(RotationStrategyPtr naming)
+    : mNaming(naming)
+    , mLockFd(-1)
+    , mMaintenanceFd(-1)
+    , mState(0)
+    , mGeneration(0)
+    , mMaxSizeInBytes(0)
+{
+    Q_ASSERT(mNaming);
+}
+
+QsLogging::SharedRotationStrategy::~SharedRotationStrategy()
+{
+    if (mState)
+        munmap(mState, sizeof(SharedState));
+    if (mLockFd >= 0)
+        ::close(mLockFd);
+    if (mMaintenanceFd >= 0)
+        ::close(mMaintenanceFd);
 }
 
-void QsLogging::FileDestination::write(const QString& message, Level)
+void QsLogging::SharedRotationStrategy::attach(const QString& logFilePath)
 {
-    mRotationStrategy->includeMessageInCalculation(message);
+    const QString lockPath = logFilePath + QLatin1String(".lock");
+    int fd;
+    do {
+        fd = ::open(QFile::encodeName(lockPath).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        std::cerr << "QsLog: could not open " << qPrintable(lockPath)
+                  << ", rotating without coordination";
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0
+        || (info.st_size < static_cast<off_t>(sizeof(SharedState))
+            && ftruncate(fd, sizeof(SharedState)) != 0)) {
+        std::cerr << "QsLog: could not size " << qPrintable(lockPath)
+                  << ", rotating without coordination";
+        ::close(fd);
+        return;
+    }
+
+    void* mapping = mmap(0, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mapping) {
+        std::cerr << "QsLog: could not map " << qPrintable(lockPath)
+                  << ", rotating without coordination";
+        ::close(fd);
+        return;
+    }
+
+    int maintenanceFd;
+    do {
+        maintenanceFd = ::open(QFile::encodeName(lockPath).constData(), O_RDWR | O_CLOEXEC);
+    } while (maintenanceFd < 0 && errno == EINTR);
+    if (maintenanceFd < 0) {
+        std::cerr << "QsLog: could not open " << qPrintable(lockPath)
+                  << ", rotating without coordination";
+        munmap(mapping, sizeof(SharedState));
+        ::close(fd);
+        return;
+    }
+
+    mLockFd = fd;
+    mMaintenanceFd = maintenanceFd;
+    mState = static_cast<SharedState*>(mapping);
+    lock(mLockFd, RotationRange);
+    if (0 == mState->magic) {
+        mState->version = SharedStateVersion;
+        mState->magic = SharedStateMagic;
+    }
+    const bool compatible = SharedStateMagic == mState->magic
+                            && SharedStateVersion == mState->version;
+    unlock(mLockFd, RotationRange);
+
+    if (!compatible) {
+        std::cerr << "QsLog: " << qPrintable(lockPath)
+                  << " was not written by this version, rotating without coordination";
+        munmap(mState, sizeof(SharedState));
+        ::close(mLockFd);
+        ::close(mMaintenanceFd);
+        mState = 0;
+        mLockFd = -1;
+        mMaintenanceFd = -1;
+    }
+}
+
+// Rotating and maintaining exclude the other processes and destinations, not each other. Open
+// file description locks (Linux 3.15) give each its own byte. Elsewhere flock() locks the whole
+// file, and a rotation can wait for maintenance running on another descriptor.
+void QsLogging::SharedRotationStrategy::lock(int fd, int range)
+{
+#ifdef F_OFD_SETLKW
+    struct flock request;
+    std::memset(&request, 0, sizeof(request));
+    request.l_type = F_WRLCK;
+    request.l_whence = SEEK_SET;
+    request.l_start = range;
+    request.l_len = 1;
+    int result;
+    do {
+        result = fcntl(fd, F_OFD_SETLKW, &request);
+    } while (result != 0 && EINTR == errno);
+    if (0 == result)
+        return;
+#else
+    Q_UNUSED(range);
+#endif
+    while (flock(fd, LOCK_EX) != 0 && EINTR == errno) {
+    }
+}
+
+void QsLogging::SharedRotationStrategy::unlock(int fd, int range)
+{
+#ifdef F_OFD_SETLK
+    struct flock request;
+    std::memset(&request, 0, sizeof(request));
+    request.l_type = F_UNLCK;
+    request.l_whence = SEEK_SET;
+    request.l_start = range;
+    request.l_len = 1;
+    fcntl(fd, F_OFD_SETLK, &request);
+#else
+    Q_UNUSED(range);
+#endif
+    // a no-op unless lock() had to fall back to it
+    flock(fd, LOCK_UN);
+}
+
+// If another process rotates between this and the open, the generation read here is already
+// stale and the first message reopens. Read after the open, it could match a file renamed away.
+void QsLogging::SharedRotationStrategy::beforeOpen(const QString& filePath)
+{
+    if (mLockFd < 0)
+        attach(filePath);
+    mNaming->beforeOpen(filePath);
+    if (!mState)
+        return;
+
+    if (!SharedStateLockFree)
+        lock(mLockFd, RotationRange);
+    mGeneration = LoadShared(&mState->generation);
+    if (!SharedStateLockFree)
+        unlock(mLockFd, RotationRange);
+}
+
+void QsLogging::SharedRotationStrategy::setInitialInfo(const QFile &file)
+{
+    mNaming->setInitialInfo(file);
+    if (!mState)
+        return;
+
+    if (!SharedStateLockFree)
+        lock(mLockFd, RotationRange);
+    // the other processes may have counted part of the file, the shared size never goes down
+    RaiseShared(&mState->size, file.size());
+    if (!SharedStateLockFree)
+        unlock(mLockFd, RotationRange);
+}
+
+void QsLogging::SharedRotationStrategy::setMessageTime(qint64 timestamp)
+{
+    mNaming->setMessageTime(timestamp);
+}
+
+void QsLogging::SharedRotationStrategy::includeMessageInCalculation(qint64 sizeInBytes)
+{
+    mNaming->includeMessageInCalculation(sizeInBytes);
+    if (!mState)
+        return;
+
+    if (!SharedStateLockFree)
+        lock(mLockFd, RotationRange);
+    AddShared(&mState->size, sizeInBytes);
+    if (!SharedStateLockFree)
+        unlock(mLockFd, RotationRange);
+}
+
+bool QsLogging::SharedRotationStrategy::shouldRotate()
+{
+    if (mState) {
+        if (!SharedStateLockFree)
+            lock(mLockFd, RotationRange);
+        const quint64 generation = LoadShared(&mState->generation);
+        const qint64 size = LoadShared(&mState->size);
+        if (!SharedStateLockFree)
+            unlock(mLockFd, RotationRange);
+        if (generation != mGeneration)
+            return true; // rotated by another process, only reopen
+        if (mMaxSizeInBytes > 0 && size > mMaxSizeInBytes)
+            return true;
+    }
+    return mNaming->shouldRotate();
+}
+
+void QsLogging::SharedRotationStrategy::rotate()
+{
+    if (!mState) {
+        mNaming->rotate();
+        return;
+    }
+
+    lock(mLockFd, RotationRange);
+    // Whoever takes the lock first rotates, the others find the generation moved on.
+    if (LoadShared(&mState->generation) == mGeneration) {
+        // only the rename, shifting the backups is left to maintain() in the background
+        mNaming->rotate();
+        StoreShared(&mState->size, qint64(0));
+        AddShared(&mState->generation, quint64(1));
+    }
+    unlock(mLockFd, RotationRange);
+}
+
+QIODevice::OpenMode QsLogging::SharedRotationStrategy::recommendedOpenModeFlag()
+{
+    return QIODevice::Append;
+}
+
+void QsLogging::SharedRotationStrategy::maintain()
+{
+    if (mLockFd < 0) {
+        mNaming->maintain();
+        return;
+    }
+
+    lock(mMaintenanceFd, MaintenanceRange);
+    mNaming->maintain();
+    unlock(mMaintenanceFd, MaintenanceRange);
+}
+
+void QsLogging::SharedRotationStrategy::setMaximumSizeInBytes(qint64 size)
+{
+    Q_ASSERT(size >= 0);
+    mMaxSizeInBytes = size;
+}
+#endif
+
+namespace
+{
+const qint64 MaintenanceIntervalMs = 60 * 60 * 1000;
+// the file is written in binary mode
+#ifdef Q_OS_WIN
+const char LineEnding[] = "\r\n";
+#else
+const char LineEnding[] = "\n";
+#endif
+
+class MaintenanceRunnable : public QRunnable
+{
+public:
+    explicit MaintenanceRunnable(const QsLogging::RotationStrategyPtr& strategy)
+        : mStrategy(strategy)
+    {}
+
+    void run() override
+    {
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+        mStrategy->maintain();
+    }
+
+private:
+    QsLogging::RotationStrategyPtr mStrategy;
+};
+}
+QsLogging::BackupSweeper::BackupSweeper()
+    : mTotalSize(0)
+    , mMaxCount(0)
+{
+}
+
+void QsLogging::BackupSweeper::setMaximumCount(int count)
+{
+    mMaxCount = count;
+}
+
+void QsLogging::BackupSweeper::setRetention(const RetentionPolicy& retention)
+{
+    mRetention = retention;
+}
+
+bool QsLogging::BackupSweeper::keepsNone() const
+{
+    return !mMaxCount && !mRetention.maxBytes && !mRetention.maxAgeSeconds;
+}
+
+void QsLogging::BackupSweeper::add(const QString& filePath)
+{
+    Backup backup;
+    backup.filePath = filePath;
+    backup.size = -1;
+    backup.modified = 0;
+    mBackups.enqueue(backup);
+}
+
+void QsLogging::BackupSweeper::sweep()
+{
+    for (int i = mBackups.size() - 1; i >= 0 && mBackups.at(i).size < 0; --i) {
+        const QFileInfo info(mBackups.at(i).filePath);
+        mBackups[i].size = info.size();
+        mBackups[i].modified = info.lastModified().toMSecsSinceEpoch();
+        mTotalSize += mBackups.at(i).size;
+    }
+
+    const qint64 oldestAllowed = QDateTime::currentMSecsSinceEpoch() - mRetention.maxAgeSeconds * Q_INT64_C(1000);
+    while (!mBackups.isEmpty()) {
+        const Backup& oldest = mBackups.head();
+        const bool overCount = mMaxCount > 0 && mBackups.size() > mMaxCount;
+        const bool overSize = mRetention.maxBytes > 0 && mTotalSize > mRetention.maxBytes;
+        const bool tooOld = mRetention.maxAgeSeconds > 0 && oldest.modified < oldestAllowed;
+        if (!overCount && !overSize && !tooOld)
+            break;
+
+        if (!QFile::remove(oldest.filePath) && QFile::exists(oldest.filePath))
+            std::cerr << "QsLog: backup delete failed " << qPrintable(oldest.filePath);
+        mTotalSize -= oldest.size;
+        mBackups.dequeue();
+    }
+}
+
+QsLogging::SequenceRotationStrategy::SequenceRotationStrategy()
+    : mCurrentSizeInBytes(0)
+    , mMaxSizeInBytes(0)
+    , mScanned(false)
+    , mNextSequence(1)
+{
+}
+
+void QsLogging::SequenceRotationStrategy::setInitialInfo(const QFile &file)
+{
+    // reopening after a rotation gives the same name, maintain() may be reading it
+    if (mFileName != file.fileName())
+        mFileName = file.fileName();
+    mCurrentSizeInBytes = file.size();
+}
+
+void QsLogging::SequenceRotationStrategy::includeMessageInCalculation(qint64 sizeInBytes)
+{
+    mCurrentSizeInBytes += sizeInBytes;
+}
+
+bool QsLogging::SequenceRotationStrategy::shouldRotate()
+{
+    return mCurrentSizeInBytes > mMaxSizeInBytes;
+}
+
+void QsLogging::SequenceRotationStrategy::rotate()
+{
+    if (mSweeper.keepsNone()) {
+        if (!QFile::remove(mFileName))
+            std::cerr << "QsLog: backup delete failed " << qPrintable(mFileName);
+        return;
+    }
+
+    QMutexLocker lock(&mMutex);
+    if (!mScanned)
+        scanBackups();
+    // other processes sharing the file may have taken the number
+    QString newName = backupName(mNextSequence);
+    while (QFile::exists(newName))
+        newName = backupName(++mNextSequence);
+    if (!QFile::rename(mFileName, newName)) {
+        std::cerr << "QsLog: could not rename log " << qPrintable(mFileName)
+                  << " to " << qPrintable(newName);
+        return;
+    }
+    mNewBackups.append(newName);
+    ++mNextSequence;
+}
+
+QIODevice::OpenMode QsLogging::SequenceRotationStrategy::recommendedOpenModeFlag()
+{
+    return QIODevice::Append;
+}
+
+void QsLogging::SequenceRotationStrategy::maintain()
+{
+    QStringList newBackups;
+    {
+        QMutexLocker lock(&mMutex);
+        if (!mScanned)
+            scanBackups();
+        newBackups.swap(mNewBackups);
+    }
+    Q_FOREACH (const QString& filePath, newBackups)
+        mSweeper.add(filePath);
+    mSweeper.sweep();
+}
+
+void QsLogging::SequenceRotationStrategy::setMaximumSizeInBytes(qint64 size)
+{
+    Q_ASSERT(size >= 0);
+    mMaxSizeInBytes = size;
+}
+
+void QsLogging::SequenceRotationStrategy::setBackupCount(int backups)
+{
+    Q_ASSERT(backups >= 0);
+    mSweeper.setMaximumCount(backups);
+}
+
+void QsLogging::SequenceRotationStrategy::setRetention(const RetentionPolicy& retention)
+{
+    mSweeper.setRetention(retention);
+}
+
+// The only directory listing, done once to pick up the backups of earlier runs.
+void QsLogging::SequenceRotationStrategy::scanBackups()
+{
+    const QFileInfo info(mFileName);
+    const QString prefix = info.fileName() + QLatin1Char('.');
+    QList<quint64> sequences;
+    Q_FOREACH (const QString& name, info.dir().entryList(QStringList(prefix + QLatin1Char('*')), QDir::Files)) {
+        bool isNumber = false;
+        const quint64 sequence = name.mid(prefix.size()).toULongLong(&isNumber);
+        if (isNumber)
+            sequences.append(sequence);
+    }
+    std::sort(sequences.begin(), sequences.end());
+
+    QStringList backups;
+    Q_FOREACH (quint64 sequence, sequences)
+        backups.append(backupName(sequence));
+    // maintain() passes them to the sweeper, together with what rotate() adds meanwhile
+    mNewBackups = backups + mNewBackups;
+    mNextSequence = sequences.isEmpty() ? 1 : sequences.last() + 1;
+    mScanned = true;
+}
+
+QString QsLogging::SequenceRotationStrategy::backupName(quint64 sequence) const
+{
+    // padded so that the backups list in order
+    return mFileName + QString::fromUtf8(".%1").arg(sequence, 6, 10, QLatin1Char('0'));
+}
+
+// Flushes messages that have been pending for longer than the policy's interval, so a quiet
+// period doesn't leave them in the buffer.
+class QsLogging::FileDestination::FlushThread : public QThread
+{
+public:
+    explicit FlushThread(FileDestination* destination)
+        : mDestination(destination)
+        , mStop(false)
+    {}
+
+    void stop()
+    {
+        {
+            QMutexLocker lock(&mDestination->mMutex);
+            mStop = true;
+            mWakeUp.wakeAll();
+        }
+        wait();
+    }
+
+protected:
+    void run() override
+    {
+        const int interval = mDestination->mFlushPolicy.intervalMs;
+        QMutexLocker lock(&mDestination->mMutex);
+        while (!mStop) {
+            mWakeUp.wait(&mDestination->mMutex, static_cast<unsigned long>(interval));
+            if (mDestination->mOldestPending.isValid()
+                && mDestination->mOldestPending.elapsed() >= interval)
+                mDestination->flushLocked();
+        }
+    }
+
+private:
+    FileDestination* mDestination;
+    QWaitCondition mWakeUp;
+    bool mStop;
+};
+
+QsLogging::FileDestination::FileDestination(const QString& filePath, RotationStrategyPtr rotationStrategy,
+                                            LayoutPtr layout, const FlushPolicy& flushPolicy,
+                                            FileWriterPtr writer)
+    : mFilePath(filePath)
+    , mWriter(writer)
+    , mCountsStoredSize(dynamic_cast<GzipFileWriter*>(writer.data()) != 0)
+    , mStoredSize(0)
+    , mRotationStrategy(rotationStrategy)
+    , mLayout(layout)
+    , mFlushPolicy(flushPolicy)
+    , mPendingMessages(0)
+    , mPendingBytes(0)
+    , mNextMaintenance(QDateTime::currentMSecsSinceEpoch() + MaintenanceIntervalMs)
+    , mWriteSequence(0)
+    , mSyncedSequence(0)
+    , mSyncing(false)
+{
+    openFile();
+    mMaintenance.setMaxThreadCount(1);
+    mMaintenance.start(new MaintenanceRunnable(mRotationStrategy));
+
+    if (mFlushPolicy.intervalMs > 0) {
+        mFlushThread.reset(new FlushThread(this));
+        mFlushThread->start(QThread::LowPriority);
+    }
+}
+
+QsLogging::FileDestination::~FileDestination()
+{
+    if (mFlushThread)
+        mFlushThread->stop();
+    flush();
+    mMaintenance.waitForDone();
+}
+
+void QsLogging::FileDestination::writeMessage(const LogMessage& message)
+{
+    writeLine(mLayout->format(message), message.level, message.timestamp);
+}
+
+QsLogging::LayoutPtr QsLogging::FileDestination::layout() const
+{
+    return mLayout;
+}
+
+void QsLogging::FileDestination::writeFormatted(const QString& line, const LogMessage& message)
+{
+    writeLine(line, message.level, message.timestamp);
+}
+
+void QsLogging::FileDestination::write(const QString& message, Level level)
+{
+    writeLine(message, level, QDateTime::currentMSecsSinceEpoch());
+}
+
+void QsLogging::FileDestination::writeLine(const QString& message, Level level, qint64 timestamp)
+{
+    // encoded once, the rotation strategy and the flush policy count these bytes
+    QByteArray line = message.toUtf8();
+    line.append(LineEnding);
+
+    QMutexLocker lock(&mMutex);
+    mRotationStrategy->setMessageTime(timestamp);
+    // age limits need a sweep now and then, even without rotations
+    if (timestamp >= mNextMaintenance) {
+        mNextMaintenance = timestamp + MaintenanceIntervalMs;
+        mMaintenance.start(new MaintenanceRunnable(mRotationStrategy));
+    }
+    if (!mCountsStoredSize)
+        mRotationStrategy->includeMessageInCalculation(line.size());
     if (mRotationStrategy->shouldRotate()) {
-        mOutputStream.setDevice(NULL);
-        mFile.close();
+        // a commit might still be waiting for messages in the file that is about to be closed
+        while (mSyncing)
+            mSyncFinished.wait(&mMutex);
+        if (mSyncedSequence < mWriteSequence)
+            syncLocked();
+        mWriter->close();
+        // doesn't wait for maintenance still running, the strategies keep out of its way
         mRotationStrategy->rotate();
-        if (!mFile.open(QFile::WriteOnly | QFile::Text | mRotationStrategy->recommendedOpenModeFlag()))
-            std::cerr << "QsLog: could not reopen log file " << qPrintable(mFile.fileName());
-        mRotationStrategy->setInitialInfo(mFile);
-        mOutputStream.setDevice(&mFile);
+        openFile();
+        mMaintenance.start(new MaintenanceRunnable(mRotationStrategy));
+        // closing the writer flushed whatever was pending
+        mPendingMessages = 0;
+        mPendingBytes = 0;
+        mOldestPending.invalidate();
     }
 
-    mOutputStream << message << Qt::endl;
-    mOutputStream.flush();
+    mWriter->write(line.constData(), line.size());
+    if (mCountsStoredSize)
+        countStoredSize();
+    ++mWriteSequence;
+    ++mPendingMessages;
+    mPendingBytes += line.size();
+    if (!mOldestPending.isValid())
+        mOldestPending.start();
+
+    if (isFlushDue(level))
+        flushLocked();
+}
+
+void QsLogging::FileDestination::flush()
+{
+    QMutexLocker lock(&mMutex);
+    flushLocked();
+}
+
+void QsLogging::FileDestination::commit()
+{
+    QMutexLocker lock(&mMutex);
+    const quint64 ticket = mWriteSequence;
+    while (mSyncedSequence < ticket) {
+        if (mSyncing) {
+            mSyncFinished.wait(&mMutex);
+            continue;
+        }
+
+        flushLocked();
+        const int descriptor = mWriter->descriptor();
+        const quint64 covered = mWriteSequence;
+        mSyncing = true;
+        // writers keep appending while the disk works, the next commit covers them
+        lock.unlock();
+        if (!FileWriter::sync(descriptor))
+            std::cerr << "QsLog: could not sync log file " << qPrintable(mFilePath);
+        lock.relock();
+        mSyncing = false;
+        mSyncedSequence = covered;
+        mSyncFinished.wakeAll();
+    }
+}
+
+bool QsLogging::FileDestination::isFlushDue(Level level) const
+{
+    return level >= FatalLevel
+        || level >= mFlushPolicy.level
+        || (mFlushPolicy.messages > 0 && mPendingMessages >= mFlushPolicy.messages)
+        || (mFlushPolicy.bytes > 0 && mPendingBytes >= mFlushPolicy.bytes)
+        || (mFlushPolicy.intervalMs > 0 && mOldestPending.elapsed() >= mFlushPolicy.intervalMs);
+}
+
+void QsLogging::FileDestination::flushLocked()
+{
+    mWriter->flush();
+    if (mCountsStoredSize)
+        countStoredSize();
+    mPendingMessages = 0;
+    mPendingBytes = 0;
+    mOldestPending.invalidate();
+}
+
+void QsLogging::FileDestination::countStoredSize()
+{
+    const qint64 size = mWriter->size();
+    mRotationStrategy->includeMessageInCalculation(size - mStoredSize);
+    mStoredSize = size;
+}
+
+void QsLogging::FileDestination::syncLocked()
+{
+    flushLocked();
+    if (!FileWriter::sync(mWriter->descriptor()))
+        std::cerr << "QsLog: could not sync log file " << qPrintable(mFilePath);
+    mSyncedSequence = mWriteSequence;
 }
 
 bool QsLogging::FileDestination::isValid()
 {
-    return mFile.isOpen();
+    return mWriter->isOpen();
 }
 
+
+void QsLogging::FileDestination::openFile()
+{
+    mRotationStrategy->beforeOpen(mFilePath);
+    const bool append = mRotationStrategy->recommendedOpenModeFlag() & QIODevice::Append;
+    if (!mWriter->open(mFilePath, append))
+        std::cerr << "QsLog: could not open log file " << qPrintable(mFilePath);
+    // after the writer cut off what a crash left, e.g. a mapped file's preallocated tail
+    mRotationStrategy->setInitialInfo(QFile(mFilePath));
+    mStoredSize = mWriter->size();
+}
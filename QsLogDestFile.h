@@ -27,8 +27,16 @@
 #define QSLOGDESTFILE_H
 
 #include "QsLogDest.h"
+#include "QsLogFileWriter.h"
+#include "QsLogLayout.h"
+#include <QElapsedTimer>
 #include <QFile>
-#include <QTextStream>
+#include <QMutex>
+#include <QQueue>
+#include <QScopedPointer>
+#include <QStringList>
+#include <QThreadPool>
+#include <QWaitCondition>
 #include <QtGlobal>
 #include <QSharedPointer>
 
@@ -39,11 +47,24 @@ class RotationStrategy
 public:
     virtual ~RotationStrategy();
 
+    //! Called with the path before the file is opened, setInitialInfo follows once it is open.
+    //! The default implementation does nothing.
+    virtual void beforeOpen(const QString& filePath);
     virtual void setInitialInfo(const QFile &file) = 0;
-    virtual void includeMessageInCalculation(const QString &message) = 0;
+    //! Capture time of the message about to be written, in ms since the epoch. Called before
+    //! includeMessageInCalculation; the default implementation ignores it.
+    virtual void setMessageTime(qint64 timestamp);
+    //! The exact number of bytes the next message adds to the file, line ending included. With
+    //! a compressing writer it is what each write or flush added to the compressed file instead.
+    virtual void includeMessageInCalculation(qint64 sizeInBytes) = 0;
     virtual bool shouldRotate() = 0;
+    //! Moves the closed log file out of the way. Runs while logging waits, keep it cheap.
     virtual void rotate() = 0;
     virtual QIODevice::OpenMode recommendedOpenModeFlag() = 0;
+    //! Shifts, deletes or compresses backups after rotate(), and once at startup to finish what
+    //! an interrupted run left. Runs on a background thread, concurrently with the other calls,
+    //! rotate() included. The default implementation does nothing.
+    virtual void maintain();
 };
 
 // Never rotates file, overwrites existing file.
@@ -51,13 +72,16 @@ class NullRotationStrategy : public RotationStrategy
 {
 public:
     void setInitialInfo(const QFile &) override {}
-    void includeMessageInCalculation(const QString &) override {}
+    void includeMessageInCalculation(qint64) override {}
     bool shouldRotate() override { return false; }
     void rotate() override {}
     QIODevice::OpenMode recommendedOpenModeFlag() override { return QIODevice::Truncate; }
 };
 
 // Rotates after a size is reached, keeps a number of <= 10 backups, appends to existing file.
+// For more backups use SequenceRotationStrategy.
+// rotate() only renames the log to a pending filename.0.N, maintain() shifts the pending files
+// into the numbered backups, oldest first.
 class SizeRotationStrategy : public RotationStrategy
 {
 public:
@@ -65,35 +89,259 @@ public:
     static const int MaxBackupCount;
 
     void setInitialInfo(const QFile &file) override;
-    void includeMessageInCalculation(const QString &message) override;
+    void includeMessageInCalculation(qint64 sizeInBytes) override;
     bool shouldRotate() override;
     void rotate() override;
     QIODevice::OpenMode recommendedOpenModeFlag() override;
+    void maintain() override;
 
     void setMaximumSizeInBytes(qint64 size);
     void setBackupCount(int backups);
+    //! Backups become filename.X.gz. They are kept while their compressed total fits in what
+    //! the uncompressed backups would take, so compression buys history instead of disk space.
+    void setCompressBackups(bool compress);
 
 private:
+    QStringList pendingBackups() const;
+    void shiftBackups(const QString& logNamePattern);
+    void maintainCompressed(const QString& logNamePattern);
+
     QString mFileName;
     qint64 mCurrentSizeInBytes;
     qint64 mMaxSizeInBytes;
     int mBackupsCount;
+    bool mCompressBackups;
+    quint64 mLastPending; // N of the last filename.0.N, only rotate() uses it
+};
+
+// Retention for the strategies that don't shift their backups. The directory is listed once by the
+// strategy, after that rotations report their backups and sweep() removes the oldest ones until
+// the count, the total size and the age fit.
+class BackupSweeper
+{
+public:
+    BackupSweeper();
+
+    //! With a size or age limit 0 means no count limit, otherwise no backups are kept.
+    void setMaximumCount(int count);
+    void setRetention(const RetentionPolicy& retention);
+    //! true when the strategy should delete the log instead of keeping a backup
+    bool keepsNone() const;
+
+    //! the next newer backup: those of earlier runs oldest first, then those made by rotate()
+    void add(const QString& filePath);
+    void sweep();
+
+private:
+    struct Backup
+    {
+        QString filePath;
+        qint64 size;     // -1 until sweep() looks at the file
+        qint64 modified; // ms since the epoch
+    };
+
+    QQueue<Backup> mBackups;
+    qint64 mTotalSize;
+    int mMaxCount;
+    RetentionPolicy mRetention;
+};
+
+// Rotates after a size is reached like SizeRotationStrategy, but backups are named filename.N with
+// an ever increasing N instead of being shifted. Rotating is one rename and retention removes only
+// the oldest backups, however many are kept.
+class SequenceRotationStrategy : public RotationStrategy
+{
+public:
+    SequenceRotationStrategy();
+
+    void setInitialInfo(const QFile &file) override;
+    void includeMessageInCalculation(qint64 sizeInBytes) override;
+    bool shouldRotate() override;
+    void rotate() override;
+    QIODevice::OpenMode recommendedOpenModeFlag() override;
+    void maintain() override;
+
+    void setMaximumSizeInBytes(qint64 size);
+    void setBackupCount(int backups);
+    void setRetention(const RetentionPolicy& retention);
+
+private:
+    void scanBackups();
+    QString backupName(quint64 sequence) const;
+
+    QString mFileName;
+    qint64 mCurrentSizeInBytes;
+    qint64 mMaxSizeInBytes;
+    // guards the scan and the backups rotate() hands over, the sweeper is maintain()'s alone
+    QMutex mMutex;
+    bool mScanned;
+    quint64 mNextSequence;
+    QStringList mNewBackups;
+    BackupSweeper mSweeper;
+};
+
+// Rotates at wall-clock boundaries: multiples of the interval counted from local midnight, so
+// 3600 seconds gives one file per hour. Backups are named after the start of their period,
+// filename.yyyyMMdd-HHmm, with a .N suffix when a period has several. The next boundary is
+// computed once per file, checking a message is a single compare.
+class TimeRotationStrategy : public RotationStrategy
+{
+public:
+    TimeRotationStrategy();
+
+    void setInitialInfo(const QFile &file) override;
+    void setMessageTime(qint64 timestamp) override;
+    void includeMessageInCalculation(qint64) override {}
+    bool shouldRotate() override;
+    void rotate() override;
+    QIODevice::OpenMode recommendedOpenModeFlag() override;
+    void maintain() override;
+
+    //! Default is an hour. Intervals of a day or more start at midnight.
+    void setIntervalInSeconds(int seconds);
+    void setBackupCount(int backups);
+    void setRetention(const RetentionPolicy& retention);
+
+private:
+    void computePeriod(qint64 time);
+    void scanBackups();
+
+    QString mFileName;
+    int mIntervalSeconds;
+    qint64 mMessageTime;
+    qint64 mPeriodStart;
+    qint64 mNextBoundary;
+    // guards the scan and the backups rotate() hands over, the sweeper is maintain()'s alone
+    QMutex mMutex;
+    bool mScanned;
+    QStringList mNewBackups;
+    BackupSweeper mSweeper;
 };
 
 typedef QSharedPointer<RotationStrategy> RotationStrategyPtr;
 
+// Rotates as soon as one of its strategies wants to, e.g. hourly or at 10 MB. The first strategy
+// names and maintains the backups, the others only decide when.
+class CompositeRotationStrategy : public RotationStrategy
+{
+public:
+    void addStrategy(RotationStrategyPtr strategy);
+
+    void beforeOpen(const QString& filePath) override;
+    void setInitialInfo(const QFile &file) override;
+    void setMessageTime(qint64 timestamp) override;
+    void includeMessageInCalculation(qint64 sizeInBytes) override;
+    bool shouldRotate() override;
+    void rotate() override;
+    QIODevice::OpenMode recommendedOpenModeFlag() override;
+    void maintain() override;
+
+private:
+    QList<RotationStrategyPtr> mStrategies;
+};
+
+#ifdef Q_OS_UNIX
+// Lets several processes log to one file and rotate it exactly once. They share filename.lock,
+// mapped into each of them: a generation that changes with every rotation and the size of the
+// current file, updated with atomic operations, so a message takes no lock and no syscall (on
+// targets without lock-free 64-bit atomics it takes the file lock instead). The process that
+// crosses the size rotates under an advisory lock on that file, the others see the new
+// generation and just reopen. The wrapped strategy names the backups: under the lock its
+// rotate() only renames, to a name maintenance isn't using (see SizeRotationStrategy), and its
+// maintain() runs in the background under a lock of its own. Every record must reach the file in
+// one O_APPEND write, as NativeFileWriter does.
+class SharedRotationStrategy : public RotationStrategy
+{
+public:
+    explicit SharedRotationStrategy(RotationStrategyPtr naming);
+    ~SharedRotationStrategy();
+
+    void beforeOpen(const QString& filePath) override;
+    void setInitialInfo(const QFile &file) override;
+    void setMessageTime(qint64 timestamp) override;
+    void includeMessageInCalculation(qint64 sizeInBytes) override;
+    bool shouldRotate() override;
+    void rotate() override;
+    QIODevice::OpenMode recommendedOpenModeFlag() override;
+    void maintain() override;
+
+    //! size of the shared file that triggers a rotation, 0 leaves it to the wrapped strategy
+    void setMaximumSizeInBytes(qint64 size);
+
+private:
+    struct SharedState;
+
+    SharedRotationStrategy(const SharedRotationStrategy&);            // not available
+    SharedRotationStrategy& operator=(const SharedRotationStrategy&); // not available
+
+    void attach(const QString& logFilePath);
+    static void lock(int fd, int range);
+    static void unlock(int fd, int range);
+
+    RotationStrategyPtr mNaming;
+    int mLockFd;
+    int mMaintenanceFd; // the lock file again, a description of its own for maintain()
+    SharedState* mState;
+    quint64 mGeneration;
+    qint64 mMaxSizeInBytes;
+};
+#endif
+
 // file message sink
 class FileDestination : public Destination
 {
 public:
-    FileDestination(const QString& filePath, RotationStrategyPtr rotationStrategy);
+    FileDestination(const QString& filePath, RotationStrategyPtr rotationStrategy,
+                    LayoutPtr layout = LayoutPtr(new TextLayout),
+                    const FlushPolicy& flushPolicy = FlushPolicy(),
+                    FileWriterPtr writer = FileWriterPtr(new QtFileWriter));
+    ~FileDestination();
+    void writeMessage(const LogMessage& message) override;
     void write(const QString& message, Level level) override;
     bool isValid() override;
+    void flush() override;
+    //! Group commit: the first caller syncs everything written so far, callers arriving while
+    //! the sync runs wait for it and then need at most one more for all of them.
+    void commit() override;
+
+    LayoutPtr layout() const;
+    //! Writes a line already formatted for the record with layout(), see RoutingDestination.
+    void writeFormatted(const QString& line, const LogMessage& message);
 
 private:
-    QFile mFile;
-    QTextStream mOutputStream;
+    class FlushThread;
+
+    void writeLine(const QString& message, Level level, qint64 timestamp);
+    bool isFlushDue(Level level) const;
+    void flushLocked();
+    void syncLocked();
+    void countStoredSize();
+
+    void openFile();
+
+    QString mFilePath;
+    FileWriterPtr mWriter;
+    // a compressing writer stores less than the text and only once a frame is complete: the
+    // rotation strategy counts the bytes it stored instead of the lines
+    bool mCountsStoredSize;
+    qint64 mStoredSize;
     QSharedPointer<RotationStrategy> mRotationStrategy;
+    LayoutPtr mLayout;
+    FlushPolicy mFlushPolicy;
+    // guards the writer, only contended when the policy has an interval
+    QMutex mMutex;
+    int mPendingMessages;
+    qint64 mPendingBytes;
+    QElapsedTimer mOldestPending;
+    QScopedPointer<FlushThread> mFlushThread;
+    // runs RotationStrategy::maintain, one task at a time
+    QThreadPool mMaintenance;
+    qint64 mNextMaintenance;
+    // commit tickets are write sequence numbers
+    quint64 mWriteSequence;
+    quint64 mSyncedSequence;
+    bool mSyncing;
+    QWaitCondition mSyncFinished;
 };
 
 }
@@ -38,6 +38,8 @@ QsLogging::FunctorDestination::FunctorDestination(QObject *receiver, const char
     : QObject(NULL)
     , mLogFunction(NULL)
 {
+    // TRACE would flood the receiver's event loop
+    setLevel(DebugLevel);
     connect(this, SIGNAL(logMessageReady(QString,int)), receiver, member, Qt::QueuedConnection);
 }
 
@@ -46,8 +48,7 @@ void QsLogging::FunctorDestination::write(const QString &message, QsLogging::Lev
 {
     if (mLogFunction)
         mLogFunction(message, level);
-
-    if (level > QsLogging::TraceLevel)
+    else
         emit logMessageReady(message, static_cast<int>(level));
 }
 
@@ -0,0 +1,388 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLogDestRecorder.h"
+#include <QDateTime>
+#include <QList>
+#include <QSemaphore>
+#include <QThread>
+#include <QtGlobal>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <new>
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct QsLogging::FlightRecorderDestination::Slot
+{
+    Slot() : sequence(0) {}
+
+    // 2 * index + 1 while record 'index' is copied in, 2 * index + 2 once it is complete
+    QAtomicInteger<quint64> sequence;
+    qint64 timestamp;
+    quint64 threadId;
+    const char* location;
+    int level;
+    int categorySize;
+    int threadNameSize;
+    int textSize;
+    // followed by the category, the thread name and the text, as UTF-8
+};
+
+namespace
+{
+// how often a dump yields to a writer still copying a record in before leaving it to the next dump
+const int DumpWaitRounds = 1000;
+
+int CopyCut(char* out, int room, const QByteArray& bytes)
+{
+    const int size = qMin(room, bytes.size());
+    std::memcpy(out, bytes.constData(), static_cast<size_t>(size));
+    return size;
+}
+
+// Dumps run on one thread, woken by records at the trigger level and on Unix by signals too. The
+// thread, started on first use, runs until the process exits. sRequestMutex guards the lists and
+// is all a writer takes; the thread holds sRunMutex while dumping, so that a recorder waits for it
+// before it is destroyed.
+QMutex sRequestMutex;
+QMutex sRunMutex;
+QList<QsLogging::FlightRecorderDestination*> sRequestedRecorders;
+QThread* sDumpThread = 0;
+
+#ifdef Q_OS_UNIX
+// A signal handler may only write to the pipe the thread reads. The pipe is never closed since a
+// handler may run at any time.
+int sWakePipe[2] = { -1, -1 };
+volatile sig_atomic_t sSignalled = 0;
+QList<QsLogging::FlightRecorderDestination*> sSignalRecorders;
+
+void WakeDumpThread()
+{
+    const int savedErrno = errno;
+    const char wake = 1;
+    // fails only when the pipe is full, and then the thread is awake already
+    if (::write(sWakePipe[1], &wake, 1) < 0) {
+    }
+    errno = savedErrno;
+}
+
+void HandleDumpSignal(int)
+{
+    sSignalled = 1;
+    WakeDumpThread();
+}
+#else
+QSemaphore sWakeSemaphore;
+
+void WakeDumpThread()
+{
+    sWakeSemaphore.release();
+}
+#endif
+
+class DumpThread : public QThread
+{
+protected:
+    void run() override
+    {
+        for (;;) {
+#ifdef Q_OS_UNIX
+            char wake;
+            const ssize_t result = ::read(sWakePipe[0], &wake, 1);
+            if (result < 0 && EINTR == errno)
+                continue;
+            if (result <= 0)
+                return;
+#else
+            sWakeSemaphore.acquire();
+#endif
+
+            QMutexLocker running(&sRunMutex);
+            QList<QsLogging::FlightRecorderDestination*> recorders;
+            {
+                QMutexLocker lock(&sRequestMutex);
+                recorders.swap(sRequestedRecorders);
+#ifdef Q_OS_UNIX
+                if (sSignalled) {
+                    sSignalled = 0;
+                    for (QsLogging::FlightRecorderDestination* recorder : sSignalRecorders) {
+                        if (!recorders.contains(recorder))
+                            recorders.append(recorder);
+                    }
+                }
+#endif
+            }
+            for (QsLogging::FlightRecorderDestination* recorder : recorders)
+                recorder->dump();
+        }
+    }
+};
+
+//! Starts the dump thread unless it runs already. Call with sRequestMutex held.
+bool StartDumpThread()
+{
+#ifdef Q_OS_UNIX
+    if (sWakePipe[0] < 0) {
+        if (pipe(sWakePipe) != 0) {
+            std::cerr << "QsLog: could not create the dump pipe: " << std::strerror(errno);
+            return false;
+        }
+        fcntl(sWakePipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(sWakePipe[1], F_SETFD, FD_CLOEXEC);
+        // the handler must never block
+        fcntl(sWakePipe[1], F_SETFL, O_NONBLOCK);
+    }
+#endif
+    if (!sDumpThread) {
+        sDumpThread = new DumpThread;
+        sDumpThread->start(QThread::LowPriority);
+    }
+    return true;
+}
+
+bool RequestDump(QsLogging::FlightRecorderDestination* recorder)
+{
+    QMutexLocker lock(&sRequestMutex);
+    if (!StartDumpThread())
+        return false;
+    if (!sRequestedRecorders.contains(recorder))
+        sRequestedRecorders.append(recorder);
+    WakeDumpThread();
+    return true;
+}
+}
+
+QsLogging::FlightRecorderDestination::FlightRecorderDestination(DestinationPtr target, int capacity,
+                                                                int slotSize, Level level)
+    : mTarget(target)
+    , mCapacity(qMax(capacity, 1))
+    , mSlotSize((qMax<int>(slotSize, sizeof(Slot) + 64) + 7) & ~7)
+    , mLevel(level)
+    , mTriggerLevel(ErrorLevel)
+    , mNextIndex(0)
+    , mDumpRequested(0)
+    , mDumpedUntil(0)
+{
+    Q_ASSERT(mTarget);
+    const size_t words = static_cast<size_t>(mSlotSize / sizeof(quint64));
+    mStorage.reset(new quint64[words * static_cast<size_t>(mCapacity)]);
+    for (int i = 0; i < mCapacity; ++i)
+        new (slotAt(i)) Slot;
+    mDumpCopy.reset(new quint64[words]);
+}
+
+QsLogging::FlightRecorderDestination::~FlightRecorderDestination()
+{
+    QMutexLocker running(&sRunMutex);
+    QMutexLocker lock(&sRequestMutex);
+    sRequestedRecorders.removeAll(this);
+#ifdef Q_OS_UNIX
+    sSignalRecorders.removeAll(this);
+#endif
+}
+
+QsLogging::FlightRecorderDestination::Slot*
+QsLogging::FlightRecorderDestination::slotAt(quint64 index) const
+{
+    char* storage = reinterpret_cast<char*>(mStorage.data());
+    return reinterpret_cast<Slot*>(storage + (index % mCapacity) * mSlotSize);
+}
+
+void QsLogging::FlightRecorderDestination::writeMessage(const LogMessage& message)
+{
+    if (message.level >= mLevel) {
+        QString text = message.message;
+        message.appendFields(text);
+
+        const quint64 index = mNextIndex.fetchAndAddRelaxed(1);
+        Slot* slot = slotAt(index);
+        if (claimSlot(slot, 2 * index + 1))
+            fillSlot(slot, index, message, text);
+    }
+
+    // the dump thread writes the target, not the caller holding the logger's lock; until it
+    // runs the following triggers only add to the same dump
+    if (message.level >= mTriggerLevel && mDumpRequested.testAndSetOrdered(0, 1)
+        && !RequestDump(this)) {
+        dump();
+    }
+}
+
+//! Only one writer fills a slot: when the ring wraps while an older record is still copied in,
+//! the newer writer waits for it, and a writer whose slot went to a newer record drops its own.
+bool QsLogging::FlightRecorderDestination::claimSlot(Slot* slot, quint64 claimed)
+{
+    for (;;) {
+        const quint64 seen = slot->sequence.loadAcquire();
+        if (seen > claimed)
+            return false;
+        if (seen & 1) {
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        if (slot->sequence.testAndSetAcquire(seen, claimed))
+            return true;
+    }
+}
+
+void QsLogging::FlightRecorderDestination::fillSlot(Slot* slot, quint64 index,
+                                                    const LogMessage& message, const QString& text)
+{
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->timestamp = message.timestamp;
+    slot->threadId = message.threadId;
+    slot->location = message.location;
+    slot->level = message.level;
+    char* payload = reinterpret_cast<char*>(slot + 1);
+    int room = mSlotSize - static_cast<int>(sizeof(Slot));
+    slot->categorySize = CopyCut(payload, room, message.category);
+    room -= slot->categorySize;
+    slot->threadNameSize = CopyCut(payload + slot->categorySize, room,
+                                   message.threadName.toUtf8());
+    room -= slot->threadNameSize;
+    slot->textSize = CopyCut(payload + slot->categorySize + slot->threadNameSize, room,
+                             text.toUtf8());
+    slot->sequence.storeRelease(2 * index + 2);
+}
+
+void QsLogging::FlightRecorderDestination::write(const QString& message, Level level)
+{
+    writeMessage(LogMessage(message, level, QDateTime::currentMSecsSinceEpoch()));
+}
+
+void QsLogging::FlightRecorderDestination::flush()
+{
+    QMutexLocker lock(&mDumpMutex);
+    if (mDumpRequested.loadAcquire())
+        writeDump();
+}
+
+void QsLogging::FlightRecorderDestination::commit()
+{
+    flush();
+}
+
+bool QsLogging::FlightRecorderDestination::isValid()
+{
+    return mTarget && mTarget->isValid();
+}
+
+QsLogging::Level QsLogging::FlightRecorderDestination::captureLevel()
+{
+    return mLevel;
+}
+
+QsLogging::DestinationPtr QsLogging::FlightRecorderDestination::target() const
+{
+    return mTarget;
+}
+
+void QsLogging::FlightRecorderDestination::setTriggerLevel(Level level)
+{
+    mTriggerLevel = level;
+}
+
+void QsLogging::FlightRecorderDestination::dump()
+{
+    QMutexLocker lock(&mDumpMutex);
+    writeDump();
+}
+
+void QsLogging::FlightRecorderDestination::writeDump()
+{
+    // triggers after this point request another dump
+    mDumpRequested.storeRelease(0);
+    const quint64 end = mNextIndex.loadAcquire();
+    const quint64 oldest = end > static_cast<quint64>(mCapacity) ? end - mCapacity : 0;
+    const Slot* copy = reinterpret_cast<const Slot*>(mDumpCopy.data());
+    const char* payload = reinterpret_cast<const char*>(copy + 1);
+    const qint64 room = mSlotSize - static_cast<int>(sizeof(Slot));
+    quint64 dumpedUntil = end;
+    for (quint64 index = qMax(oldest, mDumpedUntil); index < end; ++index) {
+        const Slot* slot = slotAt(index);
+        const quint64 complete = 2 * index + 2;
+        quint64 sequence = slot->sequence.loadAcquire();
+        for (int i = 0; sequence < complete && i < DumpWaitRounds; ++i) {
+            QThread::yieldCurrentThread();
+            sequence = slot->sequence.loadAcquire();
+        }
+        // a record still being written is left to the next dump, together with the ones after it
+        if (sequence < complete) {
+            dumpedUntil = index;
+            break;
+        }
+        // skip slots reused since 'end' was read
+        if (sequence != complete)
+            continue;
+        std::memcpy(mDumpCopy.data(), slot, static_cast<size_t>(mSlotSize));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.loadAcquire() != complete)
+            continue;
+        if (copy->categorySize < 0 || copy->threadNameSize < 0 || copy->textSize < 0
+            || static_cast<qint64>(copy->categorySize) + copy->threadNameSize + copy->textSize > room)
+            continue;
+
+        LogMessage message(QString::fromUtf8(payload + copy->categorySize + copy->threadNameSize,
+                                             copy->textSize),
+                           static_cast<Level>(copy->level), copy->timestamp);
+        message.threadId = copy->threadId;
+        message.threadName = QString::fromUtf8(payload + copy->categorySize, copy->threadNameSize);
+        message.location = copy->location;
+        message.category = QByteArray(payload, copy->categorySize);
+        mTarget->writeMessage(message);
+    }
+    mDumpedUntil = dumpedUntil;
+    mTarget->flush();
+}
+
+#ifdef Q_OS_UNIX
+bool QsLogging::FlightRecorderDestination::dumpOnSignal(int signalNumber)
+{
+    QMutexLocker lock(&sRequestMutex);
+    if (!StartDumpThread())
+        return false;
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = HandleDumpSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(signalNumber, &action, 0) != 0) {
+        std::cerr << "QsLog: could not handle signal " << signalNumber << ": "
+                  << std::strerror(errno);
+        return false;
+    }
+
+    if (!sSignalRecorders.contains(this))
+        sSignalRecorders.append(this);
+    return true;
+}
+#endif
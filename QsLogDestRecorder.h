@@ -0,0 +1,100 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGDESTRECORDER_H
+#define QSLOGDESTRECORDER_H
+
+#include "QsLogDest.h"
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QScopedArrayPointer>
+#include <QtGlobal>
+
+namespace QsLogging
+{
+// Flight recorder: keeps the last records of every level in memory and writes them to another
+// destination when a record at the trigger level arrives, on dump() or on a signal, so the
+// detail around a failure costs no I/O the rest of the time. Triggered dumps run on a thread of
+// their own; flush() and commit() wait for a pending one, e.g. before a fatal exit. The slots form a ring claimed with
+// an atomic counter and are never locked: each slot has a sequence number a writer swaps in
+// before its contents and sets again after them, and dumping keeps a copy only if the number
+// didn't change meanwhile.
+// Fields are kept as text, records longer than a slot are cut. The target is the recorder's own:
+// dumps write to it outside the logger's lock, so Logger::addDestination refuses to add both.
+class FlightRecorderDestination : public Destination
+{
+public:
+    //! 'level' is the lowest level recorded, below the logger's level too
+    explicit FlightRecorderDestination(DestinationPtr target, int capacity = 4096,
+                                       int slotSize = 512, Level level = TraceLevel);
+    ~FlightRecorderDestination();
+
+    void writeMessage(const LogMessage& message) override;
+    void write(const QString& message, Level level) override;
+    void flush() override;
+    void commit() override;
+    bool isValid() override;
+    Level captureLevel() override;
+
+    DestinationPtr target() const;
+
+    //! Records at or above the level have the dump thread dump the ring, the default is ErrorLevel.
+    void setTriggerLevel(Level level);
+    //! Writes the records not dumped before to the target, oldest first, and flushes it.
+    //! Can be called from any thread.
+    void dump();
+#ifdef Q_OS_UNIX
+    //! Dumps when the process receives the signal, e.g. SIGUSR1. The handler only wakes a thread.
+    bool dumpOnSignal(int signalNumber);
+#endif
+
+private:
+    struct Slot;
+
+    FlightRecorderDestination(const FlightRecorderDestination&);            // not available
+    FlightRecorderDestination& operator=(const FlightRecorderDestination&); // not available
+
+    Slot* slotAt(quint64 index) const;
+    bool claimSlot(Slot* slot, quint64 claimed);
+    void fillSlot(Slot* slot, quint64 index, const LogMessage& message, const QString& text);
+    void writeDump();
+
+    DestinationPtr mTarget;
+    int mCapacity;
+    int mSlotSize;
+    QScopedArrayPointer<quint64> mStorage; // quint64 for the alignment of the slots
+    Level mLevel;
+    Level mTriggerLevel;
+    QAtomicInteger<quint64> mNextIndex;
+    QAtomicInt mDumpRequested; // set by a trigger until the dump starts
+    // serializes dumps, writing records never takes it
+    QMutex mDumpMutex;
+    QScopedArrayPointer<quint64> mDumpCopy;
+    quint64 mDumpedUntil;
+};
+
+}
+
+#endif // QSLOGDESTRECORDER_H
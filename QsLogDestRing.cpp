@@ -0,0 +1,338 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLogDestRing.h"
+#include <QDateTime>
+#include <QtEndian>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+const char RingMagic[] = { 'Q', 'S', 'L', 'R' };
+const int RingMagicSize = sizeof(RingMagic);
+const quint32 RingVersion = 1;
+
+// offsets of the little endian header fields
+enum HeaderField
+{
+    VersionField = 4,
+    CapacityField = 8,
+    HeadField = 16,
+    HeadSequenceField = 24,
+    TailField = 32,
+    NextSequenceField = 40,
+    GenerationField = 48,
+    HeaderSize = 64
+};
+
+// A record is the payload size (4 bytes), the sequence number (8 bytes) and the payload. Where a
+// record header doesn't fit before the end, or the size is WrapMarker, records continue at 0.
+const quint64 EntryHeaderSize = 12;
+const quint32 WrapMarker = 0xFFFFFFFF;
+
+quint32 load32(const uchar* p)
+{
+    return qFromLittleEndian<quint32>(p);
+}
+
+quint64 load64(const uchar* p)
+{
+    return qFromLittleEndian<quint64>(p);
+}
+
+void store32(uchar* p, quint32 value)
+{
+    qToLittleEndian(value, p);
+}
+
+void store64(uchar* p, quint64 value)
+{
+    qToLittleEndian(value, p);
+}
+}
+
+const qint64 QsLogging::RingFileDestination::MinimumSize = 4096;
+
+QsLogging::RingFileDestination::RingFileDestination(const QString& filePath, qint64 sizeInBytes,
+                                                    LayoutPtr layout)
+    : mLayout(layout)
+    , mMap(0)
+    , mData(0)
+    , mCapacity(0)
+    , mHead(0)
+    , mHeadSequence(1)
+    , mTail(0)
+    , mNextSequence(1)
+    , mGeneration(0)
+    , mCount(0)
+{
+    const qint64 size = qMax(sizeInBytes, MinimumSize);
+    mFile.setFileName(filePath);
+    if (!mFile.open(QFile::ReadWrite)) {
+        std::cerr << "QsLog: could not open log file " << qPrintable(filePath);
+        return;
+    }
+    if (mFile.size() != size && !mFile.resize(size)) {
+        std::cerr << "QsLog: could not size log file " << qPrintable(filePath);
+        mFile.close();
+        return;
+    }
+#ifdef Q_OS_LINUX
+    // allocate the blocks once, from then on the file is only rewritten in place
+    posix_fallocate(mFile.handle(), 0, size);
+#endif
+
+    mMap = mFile.map(0, size);
+    if (!mMap) {
+        std::cerr << "QsLog: could not map log file " << qPrintable(filePath);
+        mFile.close();
+        return;
+    }
+    mData = mMap + HeaderSize;
+    mCapacity = static_cast<quint64>(size) - HeaderSize;
+    if (!recover())
+        reset();
+}
+
+QsLogging::RingFileDestination::~RingFileDestination()
+{
+    if (mMap)
+        mFile.unmap(mMap);
+    mFile.close();
+}
+
+// Continues a file written before, finding its newest record the way a reader does.
+bool QsLogging::RingFileDestination::recover()
+{
+    RingLogReader reader(QByteArray::fromRawData(reinterpret_cast<const char*>(mMap),
+                                                 static_cast<int>(HeaderSize + mCapacity)));
+    if (!reader.isValid())
+        return false;
+
+    mGeneration = reader.mGeneration;
+    mHead = load64(mMap + HeadField);
+    mCount = 0;
+    quint64 offset, sequence;
+    quint32 length;
+    while (reader.nextRecord(offset, length, sequence)) {
+        if (0 == mCount++)
+            mHeadSequence = sequence;
+    }
+    mTail = reader.mPos;
+    if (0 == mCount) {
+        mHead = mTail;
+        mHeadSequence = reader.mHeadSequence;
+    }
+    // new records must follow the last one found, or readers would stop in front of them
+    mNextSequence = mCount ? reader.mNextSequence : mHeadSequence;
+    return true;
+}
+
+// Starts an empty ring. The data is zeroed so no leftover can pass for a record.
+void QsLogging::RingFileDestination::reset()
+{
+    std::memset(mMap, 0, static_cast<size_t>(HeaderSize + mCapacity));
+    mHead = mTail = 0;
+    mHeadSequence = mNextSequence = 1;
+    mGeneration = 0;
+    mCount = 0;
+    std::memcpy(mMap, RingMagic, RingMagicSize);
+    store32(mMap + VersionField, RingVersion);
+    store64(mMap + CapacityField, mCapacity);
+    store64(mMap + HeadSequenceField, mHeadSequence);
+    store64(mMap + NextSequenceField, mNextSequence);
+}
+
+void QsLogging::RingFileDestination::dropOldest()
+{
+    if (mCapacity - mHead < EntryHeaderSize || WrapMarker == load32(mData + mHead)) {
+        mHead = 0;
+        return;
+    }
+    mHead += EntryHeaderSize + load32(mData + mHead);
+    ++mHeadSequence;
+    --mCount;
+}
+
+void QsLogging::RingFileDestination::append(const QByteArray& text)
+{
+    if (!mMap)
+        return;
+
+    const quint64 size = qMin<quint64>(text.size(), mCapacity - EntryHeaderSize);
+    const quint64 entrySize = EntryHeaderSize + size;
+    if (mCapacity - mTail < entrySize) {
+        // what lies between the tail and the end is given up, writing continues at 0
+        while (mCount > 0 && mHead >= mTail)
+            dropOldest();
+        if (mCapacity - mTail >= EntryHeaderSize)
+            store32(mData + mTail, WrapMarker);
+        mTail = 0;
+        ++mGeneration;
+    }
+    while (mCount > 0 && mHead >= mTail && mHead < mTail + entrySize)
+        dropOldest();
+    if (0 == mCount) {
+        mHead = mTail;
+        mHeadSequence = mNextSequence;
+    }
+
+    // The stores are ordered for a reader of a crashed process: the header moves past the
+    // dropped records before they are overwritten, the head before its sequence, and the
+    // sequence number, which makes a record valid, goes last.
+    store64(mMap + HeadField, mHead);
+    store64(mMap + HeadSequenceField, mHeadSequence);
+    store64(mMap + GenerationField, mGeneration);
+    std::atomic_signal_fence(std::memory_order_release);
+    uchar* entry = mData + mTail;
+    std::memcpy(entry + EntryHeaderSize, text.constData(), static_cast<size_t>(size));
+    store32(entry, static_cast<quint32>(size));
+    std::atomic_signal_fence(std::memory_order_release);
+    store64(entry + 4, mNextSequence);
+    std::atomic_signal_fence(std::memory_order_release);
+
+    ++mCount;
+    ++mNextSequence;
+    mTail += entrySize;
+    store64(mMap + TailField, mTail);
+    store64(mMap + NextSequenceField, mNextSequence);
+}
+
+void QsLogging::RingFileDestination::writeMessage(const LogMessage& message)
+{
+    append(mLayout->format(message).toUtf8());
+}
+
+void QsLogging::RingFileDestination::write(const QString& message, Level)
+{
+    append(message.toUtf8());
+}
+
+bool QsLogging::RingFileDestination::isValid()
+{
+    return mMap != 0;
+}
+
+void QsLogging::RingFileDestination::flush()
+{
+#ifdef Q_OS_UNIX
+    if (mMap)
+        msync(mMap, static_cast<size_t>(HeaderSize + mCapacity), MS_ASYNC);
+#endif
+}
+
+void QsLogging::RingFileDestination::commit()
+{
+#ifdef Q_OS_UNIX
+    if (mMap)
+        msync(mMap, static_cast<size_t>(HeaderSize + mCapacity), MS_SYNC);
+#endif
+}
+
+
+QsLogging::RingLogReader::RingLogReader(const QByteArray& data)
+    : mData(data)
+    , mRecords(0)
+    , mCapacity(0)
+    , mValid(false)
+    , mGeneration(0)
+    , mHeadSequence(0)
+    , mPos(0)
+    , mNextSequence(0)
+    , mVisited(0)
+{
+    if (mData.size() <= HeaderSize || std::memcmp(mData.constData(), RingMagic, RingMagicSize))
+        return;
+
+    const uchar* header = reinterpret_cast<const uchar*>(mData.constData());
+    mCapacity = static_cast<quint64>(mData.size()) - HeaderSize;
+    mPos = load64(header + HeadField);
+    if (load32(header + VersionField) != RingVersion || load64(header + CapacityField) != mCapacity
+        || mPos >= mCapacity)
+        return;
+
+    mRecords = header + HeaderSize;
+    mGeneration = load64(header + GenerationField);
+    mHeadSequence = load64(header + HeadSequenceField);
+    mValid = true;
+}
+
+bool QsLogging::RingLogReader::isValid() const
+{
+    return mValid;
+}
+
+quint64 QsLogging::RingLogReader::generation() const
+{
+    return mGeneration;
+}
+
+// The records follow the head with consecutive sequence numbers, the first one no older than the
+// header says. The walk goes on past the tail stored in the header, which lags after a crash, and
+// ends at the first record that is torn or left from an earlier lap.
+bool QsLogging::RingLogReader::nextRecord(quint64& offset, quint32& length, quint64& sequence)
+{
+    while (mValid && mVisited < mCapacity) {
+        if (mCapacity - mPos < EntryHeaderSize || WrapMarker == load32(mRecords + mPos)) {
+            if (0 == mPos)
+                return false;
+            mVisited += mCapacity - mPos;
+            mPos = 0;
+            continue;
+        }
+
+        length = load32(mRecords + mPos);
+        sequence = load64(mRecords + mPos + 4);
+        if (length > mCapacity - mPos - EntryHeaderSize)
+            return false;
+        if (mNextSequence ? sequence != mNextSequence : sequence < mHeadSequence)
+            return false;
+
+        offset = mPos + EntryHeaderSize;
+        mPos += EntryHeaderSize + length;
+        mVisited += EntryHeaderSize + length;
+        mNextSequence = sequence + 1;
+        return true;
+    }
+    return false;
+}
+
+bool QsLogging::RingLogReader::readNext(QString& line)
+{
+    quint64 offset, sequence;
+    quint32 length;
+    if (!nextRecord(offset, length, sequence))
+        return false;
+
+    line = QString::fromUtf8(reinterpret_cast<const char*>(mRecords + offset),
+                             static_cast<int>(length));
+    return true;
+}
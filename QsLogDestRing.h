@@ -0,0 +1,114 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGDESTRING_H
+#define QSLOGDESTRING_H
+
+#include "QsLogDest.h"
+#include "QsLogLayout.h"
+#include <QByteArray>
+#include <QFile>
+#include <QtGlobal>
+
+namespace QsLogging
+{
+// Black box recorder: a file of fixed size used as a ring, so it never grows, is never renamed
+// and keeps the newest messages. The file is mapped and every message is a copy into the
+// mapping; once a process crashes what it wrote is still in the file. A small header holds the
+// head and tail offsets, the sequence number of the oldest record and a generation counter
+// incremented every time writing wraps around. Each record carries its sequence number, which
+// lets a reader find records written after the header was updated and stop at a torn one.
+// Use qslog-decode to print the file.
+class RingFileDestination : public Destination
+{
+public:
+    //! sizeInBytes is the size of the whole file, header included
+    RingFileDestination(const QString& filePath, qint64 sizeInBytes,
+                        LayoutPtr layout = LayoutPtr(new TextLayout));
+    ~RingFileDestination();
+
+    static const qint64 MinimumSize;
+
+    void writeMessage(const LogMessage& message) override;
+    void write(const QString& message, Level level) override;
+    bool isValid() override;
+    //! starts writing the mapped pages back, commit() waits for them
+    void flush() override;
+    void commit() override;
+
+private:
+    RingFileDestination(const RingFileDestination&);            // not available
+    RingFileDestination& operator=(const RingFileDestination&); // not available
+
+    bool recover();
+    void reset();
+    void append(const QByteArray& text);
+    void dropOldest();
+
+    QFile mFile;
+    LayoutPtr mLayout;
+    uchar* mMap;
+    uchar* mData;
+    quint64 mCapacity;
+    quint64 mHead;
+    quint64 mHeadSequence;
+    quint64 mTail;
+    quint64 mNextSequence;
+    quint64 mGeneration;
+    quint64 mCount;
+};
+
+// Reads the records of a RingFileDestination file, oldest first.
+class RingLogReader
+{
+public:
+    explicit RingLogReader(const QByteArray& data);
+
+    //! false if the data doesn't start with a ring header
+    bool isValid() const;
+    //! times the writer wrapped around
+    quint64 generation() const;
+    //! Returns false after the newest record.
+    bool readNext(QString& line);
+
+private:
+    friend class RingFileDestination; // recovers an existing file with nextRecord
+
+    bool nextRecord(quint64& offset, quint32& length, quint64& sequence);
+
+    QByteArray mData;
+    const uchar* mRecords;
+    quint64 mCapacity;
+    bool mValid;
+    quint64 mGeneration;
+    quint64 mHeadSequence;
+    quint64 mPos;
+    quint64 mNextSequence; // 0 until the first record is read
+    quint64 mVisited;
+};
+
+}
+
+#endif // QSLOGDESTRING_H
@@ -0,0 +1,156 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLogDestRouting.h"
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QVarLengthArray>
+
+QsLogging::RoutingDestination::RoutingDestination(LayoutPtr layout)
+    : mLayout(layout)
+{
+}
+
+QSharedPointer<QsLogging::FileDestination> QsLogging::RoutingDestination::makeFile(
+    const QString& filePath, RotationStrategyPtr rotationStrategy,
+    const FlushPolicy& flushPolicy, FileWriterPtr writer)
+{
+    return QSharedPointer<FileDestination>(
+        new FileDestination(filePath, rotationStrategy, mLayout, flushPolicy, writer));
+}
+
+void QsLogging::RoutingDestination::addLevelRoute(Level lowest, Level highest,
+                                                  DestinationPtr destination)
+{
+    const int index = routeIndex(destination);
+    for (int level = lowest;level <= highest && level < OffLevel;++level) {
+        if (!mLevelRoutes[level].contains(index))
+            mLevelRoutes[level].append(index);
+    }
+}
+
+void QsLogging::RoutingDestination::addCategoryRoute(const QByteArray& category,
+                                                     DestinationPtr destination)
+{
+    mCategoryFilters.append(qMakePair(category, routeIndex(destination)));
+    QMutexLocker locker(&mCategoryMutex);
+    mCategoryRoutes.clear();
+}
+
+void QsLogging::RoutingDestination::writeMessage(const LogMessage& message)
+{
+    QVarLengthArray<int, 8> targets;
+    if (message.level < OffLevel) {
+        const QVector<int>& levelRoutes = mLevelRoutes[message.level];
+        for (int i = 0;i < levelRoutes.size();++i)
+            targets.append(levelRoutes.at(i));
+    }
+    if (!mCategoryFilters.isEmpty() && !message.category.isEmpty()) {
+        const QVector<int> routes = categoryRoutes(message.category);
+        for (int i = 0;i < routes.size();++i) {
+            if (!targets.contains(routes.at(i)))
+                targets.append(routes.at(i));
+        }
+    }
+
+    QString line;
+    bool isFormatted = false;
+    for (int i = 0;i < targets.size();++i) {
+        const Route& route = mRoutes.at(targets.at(i));
+        // the children keep their own filters, as they would under the logger
+        const DestinationPtr& child = route.destination;
+        if (message.level < child->level() && message.level < child->captureLevel())
+            continue;
+        if (!child->acceptsCategory(message.category))
+            continue;
+        if (route.file) {
+            if (!isFormatted) {
+                line = mLayout->format(message);
+                isFormatted = true;
+            }
+            route.file->writeFormatted(line, message);
+        } else {
+            route.destination->writeMessage(message);
+        }
+    }
+}
+
+void QsLogging::RoutingDestination::write(const QString& message, Level level)
+{
+    writeMessage(LogMessage(message, level, QDateTime::currentMSecsSinceEpoch()));
+}
+
+bool QsLogging::RoutingDestination::isValid()
+{
+    for (int i = 0;i < mRoutes.size();++i) {
+        if (!mRoutes.at(i).destination->isValid())
+            return false;
+    }
+    return true;
+}
+
+void QsLogging::RoutingDestination::flush()
+{
+    for (int i = 0;i < mRoutes.size();++i)
+        mRoutes.at(i).destination->flush();
+}
+
+void QsLogging::RoutingDestination::commit()
+{
+    for (int i = 0;i < mRoutes.size();++i)
+        mRoutes.at(i).destination->commit();
+}
+
+int QsLogging::RoutingDestination::routeIndex(DestinationPtr destination)
+{
+    for (int i = 0;i < mRoutes.size();++i) {
+        if (mRoutes.at(i).destination == destination)
+            return i;
+    }
+
+    Route route;
+    route.destination = destination;
+    FileDestination* file = dynamic_cast<FileDestination*>(destination.data());
+    route.file = (file && file->layout() == mLayout) ? file : 0;
+    mRoutes.append(route);
+    return mRoutes.size() - 1;
+}
+
+QVector<int> QsLogging::RoutingDestination::categoryRoutes(const QByteArray& category)
+{
+    QMutexLocker locker(&mCategoryMutex);
+    QHash<QByteArray, QVector<int> >::const_iterator it = mCategoryRoutes.constFind(category);
+    if (it != mCategoryRoutes.constEnd())
+        return it.value();
+
+    QVector<int> routes;
+    for (int i = 0;i < mCategoryFilters.size();++i) {
+        const QPair<QByteArray, int>& filter = mCategoryFilters.at(i);
+        if (Destination::categoryBelongsTo(category, filter.first) && !routes.contains(filter.second))
+            routes.append(filter.second);
+    }
+    mCategoryRoutes.insert(category, routes);
+    return routes;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGDESTROUTING_H
+#define QSLOGDESTROUTING_H
+
+#include "QsLogDest.h"
+#include "QsLogDestFile.h"
+#include "QsLogLayout.h"
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QVector>
+
+namespace QsLogging
+{
+// Sends each record to the destinations routed for its level and for its category, e.g. errors
+// to errors.log and the "net" category to net.log, in one pass instead of one full destination
+// per file. The level routes are a table indexed by level, the category routes are resolved
+// once per category name. A record reaching several files made by makeFile() is formatted once.
+// Set up the routes before adding the router to the logger.
+class RoutingDestination : public Destination
+{
+public:
+    explicit RoutingDestination(LayoutPtr layout = LayoutPtr(new TextLayout));
+
+    //! A file destination formatting with this router's layout, for the routes below.
+    QSharedPointer<FileDestination> makeFile(const QString& filePath,
+        RotationStrategyPtr rotationStrategy = RotationStrategyPtr(new NullRotationStrategy),
+        const FlushPolicy& flushPolicy = FlushPolicy(),
+        FileWriterPtr writer = FileWriterPtr(new QtFileWriter));
+
+    //! Records from 'lowest' to 'highest' go to the destination.
+    void addLevelRoute(Level lowest, Level highest, DestinationPtr destination);
+    //! Records of the category and of the categories below it go to the destination.
+    void addCategoryRoute(const QByteArray& category, DestinationPtr destination);
+
+    void writeMessage(const LogMessage& message) override;
+    void write(const QString& message, Level level) override;
+    bool isValid() override;
+    void flush() override;
+    void commit() override;
+
+private:
+    struct Route
+    {
+        DestinationPtr destination;
+        FileDestination* file; // set when it takes the lines formatted here
+    };
+
+    int routeIndex(DestinationPtr destination);
+    QVector<int> categoryRoutes(const QByteArray& category);
+
+    LayoutPtr mLayout;
+    QVector<Route> mRoutes;
+    QVector<int> mLevelRoutes[OffLevel];
+    QList<QPair<QByteArray, int> > mCategoryFilters;
+    // category name -> routes, filled as categories show up
+    QMutex mCategoryMutex;
+    QHash<QByteArray, QVector<int> > mCategoryRoutes;
+};
+
+}
+
+#endif // QSLOGDESTROUTING_H
@@ -0,0 +1,842 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLogFileWriter.h"
+#include "QsLogCompression.h"
+#include <QFileInfo>
+#include <QtGlobal>
+#include <iostream>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+
+QsLogging::FileWriter::~FileWriter()
+{
+}
+
+bool QsLogging::FileWriter::sync(int descriptor)
+{
+    if (descriptor < 0)
+        return false;
+#if defined(Q_OS_WIN)
+    return _commit(descriptor) == 0;
+#elif defined(Q_OS_DARWIN)
+    return fsync(descriptor) == 0;
+#elif defined(Q_OS_UNIX)
+    int result;
+    do {
+        result = fdatasync(descriptor);
+    } while (result < 0 && errno == EINTR);
+    return result == 0;
+#else
+    return false;
+#endif
+}
+
+bool QsLogging::QtFileWriter::open(const QString& filePath, bool append)
+{
+    mFile.setFileName(filePath);
+    return mFile.open(QFile::WriteOnly | (append ? QFile::Append : QFile::Truncate));
+}
+
+void QsLogging::QtFileWriter::close()
+{
+    mFile.close();
+}
+
+bool QsLogging::QtFileWriter::isOpen() const
+{
+    return mFile.isOpen();
+}
+
+void QsLogging::QtFileWriter::write(const char* data, qint64 size)
+{
+    if (mFile.write(data, size) != size)
+        std::cerr << "QsLog: could not write to log file " << qPrintable(mFile.fileName());
+}
+
+void QsLogging::QtFileWriter::flush()
+{
+    mFile.flush();
+}
+
+qint64 QsLogging::QtFileWriter::size() const
+{
+    return mFile.size();
+}
+
+int QsLogging::QtFileWriter::descriptor()
+{
+    return mFile.handle();
+}
+
+#ifdef Q_OS_UNIX
+const int QsLogging::NativeFileWriter::DefaultBufferSize = 64 * 1024;
+
+QsLogging::NativeFileWriter::NativeFileWriter(int bufferSize)
+    : mFd(-1)
+    , mBuffer(0)
+    , mCapacity(bufferSize)
+    , mUsed(0)
+    , mWrittenSize(0)
+{
+    Q_ASSERT(bufferSize > 0);
+    void* buffer = 0;
+    if (posix_memalign(&buffer, 4096, static_cast<size_t>(mCapacity)) == 0)
+        mBuffer = static_cast<char*>(buffer);
+    else
+        mCapacity = 0; // unbuffered, every write goes straight to the file
+}
+
+QsLogging::NativeFileWriter::~NativeFileWriter()
+{
+    close();
+    free(mBuffer);
+}
+
+bool QsLogging::NativeFileWriter::open(const QString& filePath, bool append)
+{
+    close();
+    const int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (append ? 0 : O_TRUNC);
+    do {
+        mFd = ::open(QFile::encodeName(filePath).constData(), flags, 0644);
+    } while (mFd < 0 && errno == EINTR);
+    if (mFd < 0)
+        return false;
+
+    struct stat info;
+    mWrittenSize = fstat(mFd, &info) == 0 ? static_cast<qint64>(info.st_size) : 0;
+    return true;
+}
+
+void QsLogging::NativeFileWriter::close()
+{
+    if (mFd < 0)
+        return;
+
+    flush();
+    ::close(mFd);
+    mFd = -1;
+}
+
+bool QsLogging::NativeFileWriter::isOpen() const
+{
+    return mFd >= 0;
+}
+
+void QsLogging::NativeFileWriter::write(const char* data, qint64 size)
+{
+    if (mUsed + size <= mCapacity) {
+        std::memcpy(mBuffer + mUsed, data, static_cast<size_t>(size));
+        mUsed += static_cast<int>(size);
+        return;
+    }
+
+    writeOut(data, size);
+}
+
+void QsLogging::NativeFileWriter::flush()
+{
+    writeOut(0, 0);
+}
+
+qint64 QsLogging::NativeFileWriter::size() const
+{
+    return mWrittenSize + mUsed;
+}
+
+int QsLogging::NativeFileWriter::descriptor()
+{
+    return mFd;
+}
+
+// Writes the buffered bytes followed by 'data' with as few writev calls as the kernel allows.
+void QsLogging::NativeFileWriter::writeOut(const char* data, qint64 size)
+{
+    if (mFd < 0) {
+        mUsed = 0;
+        return;
+    }
+
+    struct iovec vectors[2];
+    int count = 0;
+    if (mUsed > 0) {
+        vectors[count].iov_base = mBuffer;
+        vectors[count].iov_len = static_cast<size_t>(mUsed);
+        ++count;
+    }
+    if (size > 0) {
+        vectors[count].iov_base = const_cast<char*>(data);
+        vectors[count].iov_len = static_cast<size_t>(size);
+        ++count;
+    }
+
+    struct iovec* pending = vectors;
+    while (count > 0) {
+        const ssize_t written = ::writev(mFd, pending, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "QsLog: could not write to log file: " << std::strerror(errno);
+            break;
+        }
+
+        mWrittenSize += written;
+        size_t remaining = static_cast<size_t>(written);
+        while (count > 0 && remaining >= pending->iov_len) {
+            remaining -= pending->iov_len;
+            ++pending;
+            --count;
+        }
+        if (count > 0) {
+            pending->iov_base = static_cast<char*>(pending->iov_base) + remaining;
+            pending->iov_len -= remaining;
+        }
+    }
+    mUsed = 0;
+}
+
+const qint64 QsLogging::MappedFileWriter::DefaultSegmentSize = 4 * 1024 * 1024;
+
+QsLogging::MappedFileWriter::MappedFileWriter(qint64 segmentSize)
+    : mFd(-1)
+    , mMapping(0)
+    , mMappingOffset(0)
+    , mMappingSize(0)
+    , mSegmentSize(0)
+    , mSize(0)
+{
+    Q_ASSERT(segmentSize > 0);
+    const qint64 page = sysconf(_SC_PAGESIZE);
+    mSegmentSize = (segmentSize + page - 1) / page * page;
+}
+
+QsLogging::MappedFileWriter::~MappedFileWriter()
+{
+    close();
+}
+
+bool QsLogging::MappedFileWriter::open(const QString& filePath, bool append)
+{
+    close();
+    const int flags = O_RDWR | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC);
+    do {
+        mFd = ::open(QFile::encodeName(filePath).constData(), flags, 0644);
+    } while (mFd < 0 && errno == EINTR);
+    if (mFd < 0)
+        return false;
+
+    struct stat info;
+    const qint64 fileSize = fstat(mFd, &info) == 0 ? static_cast<qint64>(info.st_size) : 0;
+    mSize = findDataEnd(fileSize);
+    // the preallocated tail of a previous run that didn't close the file
+    if (mSize != fileSize && ftruncate(mFd, mSize) != 0)
+        mSize = fileSize;
+    return true;
+}
+
+void QsLogging::MappedFileWriter::close()
+{
+    if (mFd < 0)
+        return;
+
+    unmapSegment();
+    if (ftruncate(mFd, mSize) != 0)
+        std::cerr << "QsLog: could not truncate log file: " << std::strerror(errno);
+    ::close(mFd);
+    mFd = -1;
+}
+
+bool QsLogging::MappedFileWriter::isOpen() const
+{
+    return mFd >= 0;
+}
+
+void QsLogging::MappedFileWriter::write(const char* data, qint64 size)
+{
+    if (mFd < 0 || size <= 0)
+        return;
+
+    if (mSize + size > mMappingOffset + mMappingSize && !mapSegment(size))
+        return;
+
+    std::memcpy(mMapping + (mSize - mMappingOffset), data, static_cast<size_t>(size));
+    mSize += size;
+}
+
+void QsLogging::MappedFileWriter::flush()
+{
+    if (mMapping)
+        msync(mMapping, static_cast<size_t>(mMappingSize), MS_ASYNC);
+}
+
+qint64 QsLogging::MappedFileWriter::size() const
+{
+    return mSize;
+}
+
+// Syncing the descriptor writes back the dirty pages of the mapping as well.
+int QsLogging::MappedFileWriter::descriptor()
+{
+    return mFd;
+}
+
+// Maps the segments that follow the written data, enough of them for 'needed' more bytes.
+bool QsLogging::MappedFileWriter::mapSegment(qint64 needed)
+{
+    unmapSegment();
+
+    const qint64 page = sysconf(_SC_PAGESIZE);
+    const qint64 offset = mSize - mSize % page;
+    qint64 length = mSegmentSize;
+    while (mSize - offset + needed > length)
+        length += mSegmentSize;
+
+    if (!reserve(offset, length))
+        return false;
+
+    void* mapping = mmap(0, static_cast<size_t>(length), PROT_READ | PROT_WRITE, MAP_SHARED,
+                         mFd, static_cast<off_t>(offset));
+    if (MAP_FAILED == mapping) {
+        std::cerr << "QsLog: could not map log file: " << std::strerror(errno);
+        return false;
+    }
+
+    mMapping = static_cast<char*>(mapping);
+    mMappingOffset = offset;
+    mMappingSize = length;
+    return true;
+}
+
+void QsLogging::MappedFileWriter::unmapSegment()
+{
+    if (!mMapping)
+        return;
+
+    munmap(mMapping, static_cast<size_t>(mMappingSize));
+    mMapping = 0;
+    mMappingOffset = 0;
+    mMappingSize = 0;
+}
+
+// Gives the file real blocks up to offset + length. Writing to a hole of a full disk would be
+// a SIGBUS instead of an error, so a sparse file is only the fallback when the file system
+// can't preallocate.
+bool QsLogging::MappedFileWriter::reserve(qint64 offset, qint64 length)
+{
+#ifdef Q_OS_LINUX
+    if (fallocate(mFd, 0, static_cast<off_t>(offset), static_cast<off_t>(length)) == 0)
+        return true;
+    if (errno != EOPNOTSUPP) {
+        std::cerr << "QsLog: could not preallocate log file: " << std::strerror(errno);
+        return false;
+    }
+#endif
+    struct stat info;
+    if (fstat(mFd, &info) == 0 && info.st_size >= offset + length)
+        return true;
+    if (ftruncate(mFd, static_cast<off_t>(offset + length)) != 0) {
+        std::cerr << "QsLog: could not extend log file: " << std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+// Log files are text, so trailing zero bytes can only be preallocated space. Looks at most
+// one segment back, that's all a crash can leave behind.
+qint64 QsLogging::MappedFileWriter::findDataEnd(qint64 fileSize) const
+{
+    char block[4096];
+    const qint64 limit = qMax<qint64>(0, fileSize - mSegmentSize);
+    qint64 end = fileSize;
+    while (end > limit) {
+        const qint64 start = qMax<qint64>(limit, end - static_cast<qint64>(sizeof(block)));
+        const ssize_t read = pread(mFd, block, static_cast<size_t>(end - start), static_cast<off_t>(start));
+        if (read != end - start)
+            return end;
+        for (qint64 i = read; i > 0; --i) {
+            if (block[i - 1] != '\0')
+                return start + i;
+        }
+        end = start;
+    }
+    return end;
+}
+#endif
+
+#ifdef QSLOG_HAS_IO_URING
+namespace
+{
+enum UringRequest
+{
+    WriteRequest = 1,
+    SyncRequest = 2
+};
+}
+
+// The submission and completion rings shared with the kernel, set up with the raw syscalls.
+struct QsLogging::UringFileWriter::Ring
+{
+    Ring()
+        : fd(-1)
+        , sqMap(0), sqMapSize(0)
+        , cqMap(0), cqMapSize(0)
+        , sqes(0), sqesSize(0)
+        , sqTail(0), sqMask(0), sqArray(0)
+        , cqHead(0), cqTail(0), cqMask(0), cqes(0)
+        , pending(0)
+        , inFlightData(0), inFlightSize(0), inFlightOffset(0)
+    {}
+
+    ~Ring()
+    {
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqMap && cqMap != sqMap)
+            munmap(cqMap, cqMapSize);
+        if (sqMap)
+            munmap(sqMap, sqMapSize);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool setup(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+            return false;
+
+        sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            sqMapSize = cqMapSize = qMax(sqMapSize, cqMapSize);
+
+        sqMap = map(sqMapSize, IORING_OFF_SQ_RING);
+        cqMap = singleMap ? sqMap : map(cqMapSize, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map(sqesSize, IORING_OFF_SQES));
+        if (!sqMap || !cqMap || !sqes)
+            return false;
+
+        char* sq = static_cast<char*>(sqMap);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqMap);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void* map(size_t size, off_t offset)
+    {
+        void* mapping = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return MAP_FAILED == mapping ? 0 : mapping;
+    }
+
+    // The caller never queues more than two entries before they are consumed, the ring has room.
+    io_uring_sqe* queue(UringRequest request)
+    {
+        const unsigned tail = *sqTail;
+        const unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = request;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        return sqe;
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        int result;
+        do {
+            result = static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, 0, 0));
+        } while (result < 0 && errno == EINTR);
+        return result;
+    }
+
+    int fd;
+    void* sqMap;
+    size_t sqMapSize;
+    void* cqMap;
+    size_t cqMapSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+
+    // the batch the kernel is working on
+    iovec vector;
+    int pending;
+    const char* inFlightData;
+    qint64 inFlightSize;
+    qint64 inFlightOffset;
+};
+
+const int QsLogging::UringFileWriter::DefaultBufferSize = 64 * 1024;
+
+QsLogging::UringFileWriter::UringFileWriter(bool dataSync, int bufferSize)
+    : mRing(new Ring)
+    , mFd(-1)
+    , mActive(0)
+    , mCapacity(bufferSize)
+    , mDataSync(dataSync)
+    , mOffset(0)
+{
+    Q_ASSERT(bufferSize > 0);
+    for (int i = 0; i < 2; ++i) {
+        mBuffers[i] = static_cast<char*>(std::malloc(static_cast<size_t>(mCapacity)));
+        mUsed[i] = 0;
+    }
+    if (!mRing->setup(4))
+        std::cerr << "QsLog: could not set up io_uring: " << std::strerror(errno);
+}
+
+QsLogging::UringFileWriter::~UringFileWriter()
+{
+    close();
+    std::free(mBuffers[0]);
+    std::free(mBuffers[1]);
+}
+
+bool QsLogging::UringFileWriter::isAvailable()
+{
+    static const bool available = Ring().setup(2);
+    return available;
+}
+
+bool QsLogging::UringFileWriter::hasRing() const
+{
+    return mRing->sqes != 0;
+}
+
+bool QsLogging::UringFileWriter::open(const QString& filePath, bool append)
+{
+    close();
+    const int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC);
+    do {
+        mFd = ::open(QFile::encodeName(filePath).constData(), flags, 0644);
+    } while (mFd < 0 && errno == EINTR);
+    if (mFd < 0)
+        return false;
+
+    struct stat info;
+    mOffset = append && fstat(mFd, &info) == 0 ? static_cast<qint64>(info.st_size) : 0;
+    return true;
+}
+
+void QsLogging::UringFileWriter::close()
+{
+    if (mFd < 0)
+        return;
+
+    submit();
+    waitForCompletions();
+    ::close(mFd);
+    mFd = -1;
+}
+
+bool QsLogging::UringFileWriter::isOpen() const
+{
+    return mFd >= 0;
+}
+
+void QsLogging::UringFileWriter::write(const char* data, qint64 size)
+{
+    if (mFd < 0 || size <= 0)
+        return;
+
+    if (mUsed[mActive] + size > mCapacity) {
+        submit();
+        if (size > mCapacity) {
+            waitForCompletions();
+            writeDirect(data, size, mOffset);
+            mOffset += size;
+            return;
+        }
+    }
+
+    std::memcpy(mBuffers[mActive] + mUsed[mActive], data, static_cast<size_t>(size));
+    mUsed[mActive] += static_cast<int>(size);
+}
+
+void QsLogging::UringFileWriter::flush()
+{
+    submit();
+}
+
+qint64 QsLogging::UringFileWriter::size() const
+{
+    return mOffset + mUsed[mActive];
+}
+
+int QsLogging::UringFileWriter::descriptor()
+{
+    waitForCompletions();
+    return mFd;
+}
+
+// Submits the active buffer and switches to the other one once the kernel is done with it.
+void QsLogging::UringFileWriter::submit()
+{
+    waitForCompletions();
+    const int used = mUsed[mActive];
+    if (!used)
+        return;
+
+    Ring& ring = *mRing;
+    ring.vector.iov_base = mBuffers[mActive];
+    ring.vector.iov_len = static_cast<size_t>(used);
+    ring.inFlightData = mBuffers[mActive];
+    ring.inFlightSize = used;
+    ring.inFlightOffset = mOffset;
+
+    unsigned count = 0;
+    if (ring.sqes) {
+        io_uring_sqe* write = ring.queue(WriteRequest);
+        write->opcode = IORING_OP_WRITEV;
+        write->fd = mFd;
+        write->addr = reinterpret_cast<quintptr>(&ring.vector);
+        write->len = 1;
+        write->off = static_cast<quint64>(mOffset);
+        ++count;
+        if (mDataSync) {
+            write->flags = IOSQE_IO_LINK;
+            io_uring_sqe* sync = ring.queue(SyncRequest);
+            sync->opcode = IORING_OP_FSYNC;
+            sync->fd = mFd;
+            sync->fsync_flags = IORING_FSYNC_DATASYNC;
+            ++count;
+        }
+    }
+
+    // the kernel may take fewer entries than queued, the rest is submitted again
+    unsigned submitted = 0;
+    while (submitted < count) {
+        const int result = ring.enter(count - submitted, 0, 0);
+        if (result <= 0)
+            break;
+        submitted += static_cast<unsigned>(result);
+    }
+    ring.pending = static_cast<int>(submitted);
+    if (!count || submitted != count) {
+        if (count) {
+            // what was taken finishes first, then a fresh ring without mappings drops the rest and
+            // from now on writes are synchronous: the batch is written and synced again in full
+            std::cerr << "QsLog: could not submit log write: " << std::strerror(errno);
+            waitForCompletions();
+            mRing.reset(new Ring);
+        }
+        writeDirect(mBuffers[mActive], used, mOffset);
+        if (mDataSync)
+            fdatasync(mFd);
+    }
+
+    mOffset += used;
+    mUsed[mActive] = 0;
+    mActive ^= 1;
+}
+
+void QsLogging::UringFileWriter::waitForCompletions()
+{
+    Ring& ring = *mRing;
+    while (ring.pending > 0) {
+        const unsigned head = *ring.cqHead;
+        if (head == __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+            if (ring.enter(0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                std::cerr << "QsLog: could not wait for log write: " << std::strerror(errno);
+                ring.pending = 0;
+            }
+            continue;
+        }
+
+        const io_uring_cqe& cqe = ring.cqes[head & *ring.cqMask];
+        if (WriteRequest == cqe.user_data) {
+            if (cqe.res < 0)
+                std::cerr << "QsLog: could not write to log file: " << std::strerror(-cqe.res);
+            else if (cqe.res < ring.inFlightSize)
+                writeDirect(ring.inFlightData + cqe.res, ring.inFlightSize - cqe.res,
+                            ring.inFlightOffset + cqe.res);
+        } else if (cqe.res < 0 && cqe.res != -ECANCELED) {
+            std::cerr << "QsLog: could not sync log file: " << std::strerror(-cqe.res);
+        }
+        __atomic_store_n(ring.cqHead, head + 1, __ATOMIC_RELEASE);
+        --ring.pending;
+    }
+}
+
+void QsLogging::UringFileWriter::writeDirect(const char* data, qint64 size, qint64 offset)
+{
+    while (size > 0) {
+        const ssize_t written = pwrite(mFd, data, static_cast<size_t>(size), static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "QsLog: could not write to log file: " << std::strerror(errno);
+            return;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
+#endif
+
+const int QsLogging::GzipFileWriter::DefaultFrameSize = 256 * 1024;
+
+QsLogging::GzipFileWriter::GzipFileWriter(FileWriterPtr output, int frameSize)
+    : mOutput(output)
+    , mFrameSize(frameSize)
+    , mSize(0)
+{
+    Q_ASSERT(frameSize > 0);
+    mFrame.reserve(frameSize);
+}
+
+QsLogging::GzipFileWriter::~GzipFileWriter()
+{
+    close();
+}
+
+bool QsLogging::GzipFileWriter::open(const QString& filePath, bool append)
+{
+    mFrame.resize(0);
+    mSize = 0;
+    // Appended members continue the same gzip stream, unless a member torn by a crash is in the
+    // way: readers stop there, so it goes.
+    if (append && QFile::exists(filePath)) {
+        const qint64 completeSize = GzipCompleteSize(filePath);
+        if (completeSize < QFileInfo(filePath).size()) {
+            std::cerr << "QsLog: dropping the incomplete end of " << qPrintable(filePath);
+            if (!QFile::resize(filePath, completeSize))
+                std::cerr << "QsLog: could not truncate " << qPrintable(filePath);
+        }
+    }
+    if (!mOutput->open(filePath, append))
+        return false;
+    mSize = mOutput->size();
+    return true;
+}
+
+void QsLogging::GzipFileWriter::close()
+{
+    if (!mOutput->isOpen())
+        return;
+
+    writeFrame();
+    mOutput->close();
+}
+
+bool QsLogging::GzipFileWriter::isOpen() const
+{
+    return mOutput->isOpen();
+}
+
+void QsLogging::GzipFileWriter::write(const char* data, qint64 size)
+{
+    mFrame.append(data, static_cast<int>(size));
+    if (mFrame.size() >= mFrameSize)
+        writeFrame();
+}
+
+void QsLogging::GzipFileWriter::flush()
+{
+    writeFrame();
+    mOutput->flush();
+}
+
+qint64 QsLogging::GzipFileWriter::size() const
+{
+    return mSize;
+}
+
+int QsLogging::GzipFileWriter::descriptor()
+{
+    return mOutput->descriptor();
+}
+
+void QsLogging::GzipFileWriter::writeFrame()
+{
+    if (mFrame.isEmpty())
+        return;
+
+    const QByteArray member = GzipCompress(mFrame);
+    mOutput->write(member.constData(), member.size());
+    mSize += member.size();
+    // keeps the reserved capacity
+    mFrame.resize(0);
+}
+
+QsLogging::FileWriterPtr QsLogging::MakeFileWriter(FileBackend backend)
+{
+    if (CompressedFileBackend == backend) {
+#ifdef Q_OS_UNIX
+        return FileWriterPtr(new GzipFileWriter(FileWriterPtr(new NativeFileWriter)));
+#else
+        return FileWriterPtr(new GzipFileWriter(FileWriterPtr(new QtFileWriter)));
+#endif
+    }
+
+#ifdef QSLOG_HAS_IO_URING
+    if (IoUringFileBackend == backend && UringFileWriter::isAvailable()) {
+        QSharedPointer<UringFileWriter> writer(new UringFileWriter);
+        if (writer->hasRing())
+            return writer;
+    }
+#endif
+#ifdef Q_OS_UNIX
+    if (NativeFileBackend == backend || IoUringFileBackend == backend)
+        return FileWriterPtr(new NativeFileWriter);
+    if (MappedFileBackend == backend)
+        return FileWriterPtr(new MappedFileWriter);
+#else
+    Q_UNUSED(backend);
+#endif
+    return FileWriterPtr(new QtFileWriter);
+}
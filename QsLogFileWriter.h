@@ -0,0 +1,246 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGFILEWRITER_H
+#define QSLOGFILEWRITER_H
+
+#include "QsLogDest.h"
+#include <QByteArray>
+#include <QFile>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QString>
+#include <QtGlobal>
+
+// The io_uring backend needs the 5.4 kernel headers, IORING_FEAT_SINGLE_MMAP stands for them
+// (the IORING_OP_ values became an enum later and can't be tested for).
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_SINGLE_MMAP)
+#define QSLOG_HAS_IO_URING
+#endif
+#endif
+
+namespace QsLogging
+{
+// Moves the encoded bytes of FileDestination to disk, as they are: line endings are up to the
+// destination. Writers may buffer; flush() hands everything to the OS.
+class FileWriter
+{
+public:
+    virtual ~FileWriter();
+
+    virtual bool open(const QString& filePath, bool append) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+    virtual void write(const char* data, qint64 size) = 0;
+    virtual void flush() = 0;
+    //! Bytes in the file, including what is still buffered.
+    virtual qint64 size() const = 0;
+    //! Waits until what flush() handed over reached the OS and returns the descriptor to sync,
+    //! -1 when closed.
+    virtual int descriptor() = 0;
+
+    //! fdatasync or the platform's equivalent, doesn't touch any writer state.
+    static bool sync(int descriptor);
+};
+typedef QSharedPointer<FileWriter> FileWriterPtr;
+
+// QFile based writer, works everywhere.
+class QtFileWriter : public FileWriter
+{
+public:
+    bool open(const QString& filePath, bool append) override;
+    void close() override;
+    bool isOpen() const override;
+    void write(const char* data, qint64 size) override;
+    void flush() override;
+    qint64 size() const override;
+    int descriptor() override;
+
+private:
+    QFile mFile;
+};
+
+#ifdef Q_OS_UNIX
+// Writes through a raw O_APPEND file descriptor. Bytes are collected in a page-aligned buffer and
+// a full buffer goes out together with the incoming data in a single writev(2).
+class NativeFileWriter : public FileWriter
+{
+public:
+    explicit NativeFileWriter(int bufferSize = DefaultBufferSize);
+    ~NativeFileWriter();
+
+    static const int DefaultBufferSize;
+
+    bool open(const QString& filePath, bool append) override;
+    void close() override;
+    bool isOpen() const override;
+    void write(const char* data, qint64 size) override;
+    void flush() override;
+    qint64 size() const override;
+    int descriptor() override;
+
+private:
+    NativeFileWriter(const NativeFileWriter&);            // not available
+    NativeFileWriter& operator=(const NativeFileWriter&); // not available
+
+    void writeOut(const char* data, qint64 size);
+
+    int mFd;
+    char* mBuffer;
+    int mCapacity;
+    int mUsed;
+    qint64 mWrittenSize;
+};
+
+// Appends by copying into a shared mapping of the file, so writing a message makes no syscall.
+// The file grows in preallocated segments and is cut back to the written size when closed; pages
+// already copied survive a crash of the process. flush() only schedules writeback, combine with
+// a FlushPolicy interval for a background cadence. A crash leaves the preallocated tail zeroed,
+// opening the file for append drops it again.
+class MappedFileWriter : public FileWriter
+{
+public:
+    explicit MappedFileWriter(qint64 segmentSize = DefaultSegmentSize);
+    ~MappedFileWriter();
+
+    static const qint64 DefaultSegmentSize;
+
+    bool open(const QString& filePath, bool append) override;
+    void close() override;
+    bool isOpen() const override;
+    void write(const char* data, qint64 size) override;
+    void flush() override;
+    qint64 size() const override;
+    int descriptor() override;
+
+private:
+    MappedFileWriter(const MappedFileWriter&);            // not available
+    MappedFileWriter& operator=(const MappedFileWriter&); // not available
+
+    bool mapSegment(qint64 needed);
+    void unmapSegment();
+    bool reserve(qint64 offset, qint64 length);
+    qint64 findDataEnd(qint64 fileSize) const;
+
+    int mFd;
+    char* mMapping;
+    qint64 mMappingOffset;
+    qint64 mMappingSize;
+    qint64 mSegmentSize;
+    qint64 mSize;
+};
+#endif
+
+#ifdef QSLOG_HAS_IO_URING
+// Hands full buffers to the kernel through io_uring and fills the second buffer while the first
+// one is being written, so the logging thread doesn't sit in write(2). With 'dataSync' each batch
+// is followed by a linked fdatasync. flush() returns once the batch is submitted, the bytes reach
+// the file when the kernel completes it. Check isAvailable() before using it directly.
+class UringFileWriter : public FileWriter
+{
+public:
+    explicit UringFileWriter(bool dataSync = false, int bufferSize = DefaultBufferSize);
+    ~UringFileWriter();
+
+    static const int DefaultBufferSize;
+    //! false when the kernel is too old or io_uring is blocked
+    static bool isAvailable();
+    //! false when this writer's ring could not be set up, it then writes synchronously
+    bool hasRing() const;
+
+    bool open(const QString& filePath, bool append) override;
+    void close() override;
+    bool isOpen() const override;
+    void write(const char* data, qint64 size) override;
+    void flush() override;
+    qint64 size() const override;
+    int descriptor() override;
+
+private:
+    struct Ring;
+
+    UringFileWriter(const UringFileWriter&);            // not available
+    UringFileWriter& operator=(const UringFileWriter&); // not available
+
+    void submit();
+    void waitForCompletions();
+    void writeDirect(const char* data, qint64 size, qint64 offset);
+
+    QScopedPointer<Ring> mRing;
+    int mFd;
+    char* mBuffers[2];
+    int mUsed[2];
+    int mActive;
+    int mCapacity;
+    bool mDataSync;
+    qint64 mOffset;
+};
+#endif
+
+// Compresses the stream into gzip members, one per flush() or per frame size of text, and writes
+// them through another writer. Every member decodes on its own, so the live file can be followed
+// with tail -f | zcat and a crash loses at most the frame being collected: opening for append cuts
+// off a member the crash left incomplete. Flushing every message makes frames too small to
+// compress, pair it with a FlushPolicy that batches. size() is what the file holds, so rotation
+// limits apply to the compressed size.
+class GzipFileWriter : public FileWriter
+{
+public:
+    explicit GzipFileWriter(FileWriterPtr output, int frameSize = DefaultFrameSize);
+    ~GzipFileWriter();
+
+    static const int DefaultFrameSize;
+
+    bool open(const QString& filePath, bool append) override;
+    void close() override;
+    bool isOpen() const override;
+    void write(const char* data, qint64 size) override;
+    void flush() override;
+    //! compressed bytes in the file, the open frame counts once it is written
+    qint64 size() const override;
+    int descriptor() override;
+
+private:
+    void writeFrame();
+
+    FileWriterPtr mOutput;
+    QByteArray mFrame;
+    int mFrameSize;
+    qint64 mSize;
+};
+
+//! Creates the writer for a backend, falling back to QtFileWriter where it isn't available.
+FileWriterPtr MakeFileWriter(FileBackend backend);
+
+}
+
+#endif // QSLOGFILEWRITER_H
@@ -0,0 +1,262 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLogLayout.h"
+#include <QDateTime>
+#include <QLocale>
+#include <QMetaType>
+#include <QtGlobal>
+#include <QtNumeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QSLOG_JSON_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define QSLOG_JSON_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+const char* JsonLevelName(QsLogging::Level level)
+{
+    switch (level) {
+        case QsLogging::TraceLevel:
+            return "TRACE";
+        case QsLogging::DebugLevel:
+            return "DEBUG";
+        case QsLogging::InfoLevel:
+            return "INFO";
+        case QsLogging::WarnLevel:
+            return "WARN";
+        case QsLogging::ErrorLevel:
+            return "ERROR";
+        case QsLogging::FatalLevel:
+            return "FATAL";
+        default:
+            return "";
+    }
+}
+
+inline bool needsEscaping(ushort c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Returns the index of the first character at or after 'from' that must be escaped, or 'size'.
+// The vector paths test 8 UTF-16 code units (16 bytes) per iteration and leave the exact
+// position inside a matching block to the scalar loop.
+int findEscapable(const ushort* data, int from, int size)
+{
+#if defined(QSLOG_JSON_SSE2)
+    const __m128i quote = _mm_set1_epi16('"');
+    const __m128i backslash = _mm_set1_epi16('\\');
+    const __m128i space = _mm_set1_epi16(0x20);
+    const __m128i zero = _mm_setzero_si128();
+    for (;from + 8 <= size;from += 8) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+        // saturating 0x20 - c is zero exactly when c >= 0x20
+        const __m128i printable = _mm_cmpeq_epi16(_mm_subs_epu16(space, chunk), zero);
+        const __m128i special = _mm_or_si128(_mm_cmpeq_epi16(chunk, quote),
+                                             _mm_cmpeq_epi16(chunk, backslash));
+        if (_mm_movemask_epi8(_mm_andnot_si128(special, printable)) != 0xFFFF)
+            break;
+    }
+#elif defined(QSLOG_JSON_NEON)
+    const uint16x8_t quote = vdupq_n_u16('"');
+    const uint16x8_t backslash = vdupq_n_u16('\\');
+    const uint16x8_t space = vdupq_n_u16(0x20);
+    for (;from + 8 <= size;from += 8) {
+        const uint16x8_t chunk = vld1q_u16(data + from);
+        const uint16x8_t hits = vorrq_u16(vcltq_u16(chunk, space),
+                                          vorrq_u16(vceqq_u16(chunk, quote),
+                                                    vceqq_u16(chunk, backslash)));
+        const uint64x2_t wide = vreinterpretq_u64_u16(hits);
+        if (vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1))
+            break;
+    }
+#endif
+    for (;from < size;++from) {
+        if (needsEscaping(data[from]))
+            return from;
+    }
+    return size;
+}
+
+void appendEscaped(QString& out, ushort c)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    switch (c) {
+        case '"':
+            out.append(QLatin1String("\\\""));
+            break;
+        case '\\':
+            out.append(QLatin1String("\\\\"));
+            break;
+        case '\n':
+            out.append(QLatin1String("\\n"));
+            break;
+        case '\r':
+            out.append(QLatin1String("\\r"));
+            break;
+        case '\t':
+            out.append(QLatin1String("\\t"));
+            break;
+        case '\b':
+            out.append(QLatin1String("\\b"));
+            break;
+        case '\f':
+            out.append(QLatin1String("\\f"));
+            break;
+        default:
+            out.append(QLatin1String("\\u00"));
+            out.append(QLatin1Char(hexDigits[(c >> 4) & 0xF]));
+            out.append(QLatin1Char(hexDigits[c & 0xF]));
+            break;
+    }
+}
+
+void appendJsonValue(QString& out, const QVariant& value)
+{
+    switch (value.userType()) {
+        case QMetaType::UnknownType:
+            out.append(QLatin1String("null"));
+            break;
+        case QMetaType::Bool:
+            out.append(value.toBool() ? QLatin1String("true") : QLatin1String("false"));
+            break;
+        case QMetaType::Int:
+        case QMetaType::Long:
+        case QMetaType::Short:
+        case QMetaType::LongLong:
+            out.append(QString::number(value.toLongLong()));
+            break;
+        case QMetaType::UInt:
+        case QMetaType::ULong:
+        case QMetaType::UShort:
+        case QMetaType::ULongLong:
+            out.append(QString::number(value.toULongLong()));
+            break;
+        case QMetaType::Float:
+        case QMetaType::Double: {
+            const double d = value.toDouble();
+            if (qIsFinite(d))
+                out.append(QString::number(d, 'g', QLocale::FloatingPointShortest));
+            else
+                out.append(QLatin1String("null"));
+            break;
+        }
+        default:
+            QsLogging::JsonLayout::appendJsonString(out, value.toString());
+            break;
+    }
+}
+
+void appendJsonObject(QString& out, const char* name, const QsLogging::LogFieldList& fields)
+{
+    out.append(QLatin1String(",\""));
+    out.append(QLatin1String(name));
+    out.append(QLatin1String("\":{"));
+    for (int i = 0;i < fields.size();++i) {
+        const QsLogging::LogField& field = fields.at(i);
+        if (i)
+            out.append(QLatin1Char(','));
+        QsLogging::JsonLayout::appendJsonString(out, QString::fromUtf8(field.key));
+        out.append(QLatin1Char(':'));
+        appendJsonValue(out, field.value);
+    }
+    out.append(QLatin1Char('}'));
+}
+}
+
+QsLogging::Layout::~Layout()
+{
+}
+
+QString QsLogging::TextLayout::format(const LogMessage& message)
+{
+    return message.formatted();
+}
+
+QString QsLogging::JsonLayout::format(const LogMessage& message)
+{
+    // QDebug leaves a separator after the last streamed item
+    QString text = message.message;
+    if (text.endsWith(QLatin1Char(' ')))
+        text.chop(1);
+
+    QString line;
+    line.reserve(text.size() + 80);
+    line.append(QLatin1String("{\"level\":\""));
+    line.append(QLatin1String(JsonLevelName(message.level)));
+    line.append(QLatin1String("\",\"time\":\""));
+    line.append(QDateTime::fromMSecsSinceEpoch(message.timestamp).toUTC()
+                .toString(QLatin1String("yyyy-MM-ddThh:mm:ss.zzz'Z'")));
+    line.append(QLatin1String("\","));
+    if (message.threadId) {
+        line.append(QLatin1String("\"thread\":"));
+        appendJsonString(line, message.threadLabel());
+        line.append(QLatin1String(",\"thread_id\":"));
+        line.append(QString::number(message.threadId));
+        line.append(QLatin1Char(','));
+    }
+    if (message.location) {
+        line.append(QLatin1String("\"location\":"));
+        appendJsonString(line, QString::fromLatin1(message.location));
+        line.append(QLatin1Char(','));
+    }
+    if (!message.category.isEmpty()) {
+        line.append(QLatin1String("\"category\":"));
+        appendJsonString(line, QString::fromUtf8(message.category));
+        line.append(QLatin1Char(','));
+    }
+    line.append(QLatin1String("\"message\":"));
+    appendJsonString(line, text);
+
+    if (message.context.data())
+        appendJsonObject(line, "context", message.contextFields());
+    if (!message.fields.isEmpty())
+        appendJsonObject(line, "fields", message.fields);
+    line.append(QLatin1Char('}'));
+    return line;
+}
+
+void QsLogging::JsonLayout::appendJsonString(QString& out, const QString& text)
+{
+    const ushort* data = reinterpret_cast<const ushort*>(text.constData());
+    const int size = text.size();
+
+    out.append(QLatin1Char('"'));
+    int runStart = 0;
+    while (runStart < size) {
+        const int runEnd = findEscapable(data, runStart, size);
+        out.append(text.constData() + runStart, runEnd - runStart);
+        if (runEnd == size)
+            break;
+        appendEscaped(out, data[runEnd]);
+        runStart = runEnd + 1;
+    }
+    out.append(QLatin1Char('"'));
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGLAYOUT_H
+#define QSLOGLAYOUT_H
+
+#include "QsLogMessage.h"
+#include <QSharedPointer>
+#include <QString>
+
+namespace QsLogging
+{
+// Turns a log record into the line a destination writes, without the line terminator.
+class QSLOG_SHARED_OBJECT Layout
+{
+public:
+    virtual ~Layout();
+    virtual QString format(const LogMessage& message) = 0;
+};
+typedef QSharedPointer<Layout> LayoutPtr;
+
+// The classic "LEVEL timestamp message" line.
+class QSLOG_SHARED_OBJECT TextLayout : public Layout
+{
+public:
+    QString format(const LogMessage& message) override;
+};
+
+// One JSON object per record: {"level":..,"time":..,"thread":..,"thread_id":..,"location":..,
+// "category":..,"message":..,"context":{..},"fields":{..}}.
+// The time is UTC in ISO 8601 format, typed fields keep their JSON type.
+class QSLOG_SHARED_OBJECT JsonLayout : public Layout
+{
+public:
+    QString format(const LogMessage& message) override;
+
+    //! Appends text as a quoted JSON string. Runs that need no escaping are copied in bulk.
+    static void appendJsonString(QString& out, const QString& text);
+};
+
+}
+
+#endif // QSLOGLAYOUT_H
@@ -0,0 +1,130 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef QSLOGMESSAGE_H
+#define QSLOGMESSAGE_H
+
+#include "QsLogLevel.h"
+#include <QByteArray>
+#include <QDebug>
+#include <QExplicitlySharedDataPointer>
+#include <QSharedData>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+#include <QtGlobal>
+
+#ifdef QSLOG_IS_SHARED_LIBRARY
+#define QSLOG_SHARED_OBJECT Q_DECL_EXPORT
+#elif QSLOG_IS_SHARED_LIBRARY_IMPORT
+#define QSLOG_SHARED_OBJECT Q_DECL_IMPORT
+#else
+#define QSLOG_SHARED_OBJECT
+#endif
+
+namespace QsLogging
+{
+
+//! A typed key/value pair attached to a log record. The value stays a QVariant until a
+//! destination decides how (and whether) to render it.
+struct QSLOG_SHARED_OBJECT LogField
+{
+    LogField() {}
+    LogField(const char* key_, const QVariant& value_) : key(key_), value(value_) {}
+    QByteArray key;
+    QVariant value;
+};
+typedef QVector<LogField> LogFieldList;
+
+//! Creates a structured field, e.g. QLOG_INFO() << "done" << QsLogging::kv("latency_us", t);
+template <typename T>
+inline LogField kv(const char* key, const T& value)
+{
+    return LogField(key, QVariant::fromValue(value));
+}
+
+inline LogField kv(const char* key, const char* value)
+{
+    return LogField(key, QVariant(QString::fromUtf8(value)));
+}
+
+//! One entry of a thread's diagnostic context (see ScopedContext). Entries are immutable and
+//! point to their enclosing entry, so a record captures the whole context by taking a reference.
+class QSLOG_SHARED_OBJECT LogContext : public QSharedData
+{
+public:
+    LogContext(const LogField& field_, const QExplicitlySharedDataPointer<LogContext>& parent_)
+        : field(field_), parent(parent_) {}
+
+    LogField field;
+    QExplicitlySharedDataPointer<LogContext> parent;
+};
+typedef QExplicitlySharedDataPointer<LogContext> LogContextPtr;
+
+//! Fields streamed into a plain QDebug (e.g. when logging is disabled) print as key=value.
+QSLOG_SHARED_OBJECT QDebug operator<<(QDebug dbg, const LogField& field);
+
+//! A single log record, as captured by the logging macros and handed to the destinations.
+class QSLOG_SHARED_OBJECT LogMessage
+{
+public:
+    LogMessage();
+    LogMessage(const QString& message_, Level level_, qint64 timestamp_);
+
+    //! The "LEVEL timestamp message key=value" line written by the text destinations. It is
+    //! built on first use, so records that only reach structured sinks never pay for it.
+    const QString& formatted() const;
+
+    //! The context fields, outermost first.
+    LogFieldList contextFields() const;
+
+    //! The thread name, or its id in hex when the thread has no name.
+    QString threadLabel() const;
+
+    //! Appends the context fields and the fields as key=value, space separated, the way
+    //! formatted() ends.
+    void appendFields(QString& out) const;
+
+    //! Appends the text form of a field value; strings containing spaces or quotes are quoted.
+    static void appendFieldValue(QString& out, const QVariant& value);
+
+    QString message;     // text streamed through QDebug
+    Level level;
+    qint64 timestamp;    // milliseconds since the epoch
+    quint64 threadId;    // 0 when unknown
+    QString threadName;  // QThread::objectName() of the logging thread
+    const char* location; // "file.cpp:42" with QS_LOG_LINE_NUMBERS, 0 otherwise
+    QByteArray category;  // QLoggingCategory name for messages routed from Qt
+    LogFieldList fields;
+    LogContextPtr context; // the logging thread's ScopedContext entries
+
+private:
+    mutable QString mFormatted;
+    mutable bool mIsFormatted;
+};
+
+} // end namespace
+
+#endif // QSLOGMESSAGE_H
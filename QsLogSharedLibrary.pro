@@ -19,7 +19,7 @@ win32 {
 
 unix:!macx {
     # make install will install the shared object in the appropriate folders
-    headers.files = QsLog.h QsLogDest.h QsLogLevel.h
+    headers.files = QsLog.h QsLogDest.h QsLogLevel.h QsLogMessage.h
     headers.path = /usr/include/$(QMAKE_TARGET)
 
     other_files.files = *.txt
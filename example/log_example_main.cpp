@@ -67,7 +67,8 @@ int main(int argc, char *argv[])
    QLOG_WARN()  << "Uh-oh!";
    qDebug() << "This message won't be picked up by the logger";
    QLOG_ERROR() << "An error has occurred";
-   qWarning() << "Neither will this one";
+   logger.installQtMessageHandler();
+   qWarning() << "This one will, Qt messages are now routed through QsLog";
    QLOG_FATAL() << "Fatal error!";
 
    logger.setLoggingLevel(QsLogging::OffLevel);
@@ -0,0 +1,11 @@
+# Command line tool that renders binary and ring log files as text.
+
+QT -= gui
+TARGET = qslog-decode
+CONFIG += console
+CONFIG -= app_bundle
+TEMPLATE = app
+
+SOURCES += qslog_decode_main.cpp
+
+include(../QsLog.pri)
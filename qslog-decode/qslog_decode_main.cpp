@@ -0,0 +1,91 @@
+// Copyright (c) 2013, Razvan Petru
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or other
+//   materials provided with the distribution.
+// * The name of the contributors may not be used to endorse or promote products
+//   derived from this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+// OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "QsLog.h"
+#include "QsLogDestBinary.h"
+#include "QsLogDestRing.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+#include <QTextCodec>
+#endif
+#include <iostream>
+
+// Prints logs written by BinaryFileDestination in the regular text format, and the messages kept
+// by RingFileDestination oldest first.
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList files = a.arguments().mid(1);
+    if (files.removeAll(QString::fromLatin1("--threads")))
+        QsLogging::Logger::instance().setIncludeThreadName(true);
+    if (files.isEmpty()) {
+        std::cerr << "usage: qslog-decode [--threads] <binary or ring log file>..." << std::endl;
+        return 2;
+    }
+
+    QTextStream out(stdout);
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+    out.setCodec(QTextCodec::codecForName("UTF-8"));
+#endif
+
+    int status = 0;
+    Q_FOREACH (const QString &fileName, files) {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly)) {
+            std::cerr << "qslog-decode: could not open " << qPrintable(fileName) << std::endl;
+            status = 1;
+            continue;
+        }
+
+        const QByteArray data = file.readAll();
+        QsLogging::RingLogReader ring(data);
+        if (ring.isValid()) {
+            QString line;
+            while (ring.readNext(line))
+                out << line << '\n';
+            continue;
+        }
+
+        QsLogging::BinaryLogReader reader(data);
+        QsLogging::LogMessage message;
+        while (reader.readNext(message))
+            out << message.formatted() << '\n';
+
+        if (reader.hasError()) {
+            out.flush();
+            std::cerr << "qslog-decode: " << qPrintable(fileName)
+                      << ": stopped at truncated or corrupt data" << std::endl;
+            status = 1;
+        }
+    }
+    out.flush();
+
+    QsLogging::Logger::destroyInstance();
+    return status;
+}
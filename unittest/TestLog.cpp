@@ -1,14 +1,29 @@
 #include "QtTestUtil/QtTestUtil.h"
 #include "QsLog.h"
+#include "QsLogCompression.h"
 #include "QsLogDest.h"
+#include "QsLogDestBinary.h"
+#include "QsLogDestFile.h"
+#include "QsLogDestRecorder.h"
+#include "QsLogDestRing.h"
+#include "QsLogDestRouting.h"
+#include "QsLogLayout.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
 #include <QHash>
+#include <QLoggingCategory>
 #include <QSharedPointer>
+#include <QTemporaryDir>
+#include <QThread>
 #include <QtGlobal>
 
 // A destination that tracks log messages
 class MockDestination : public QsLogging::Destination
 {
 public:
+    MockDestination() : mCommitCount(0) {}
+
     virtual void write(const QString &message, QsLogging::Level level)
     {
         Message m;
@@ -23,6 +38,11 @@ public:
         return true;
     }
 
+    virtual void commit()
+    {
+        ++mCommitCount;
+    }
+
     struct Message
     {
         Message() : level(QsLogging::TraceLevel) {}
@@ -34,6 +54,7 @@ public:
     {
         mMessages.clear();
         mCountByLevel.clear();
+        mCommitCount = 0;
     }
 
     int messageCount() const
@@ -41,6 +62,11 @@ public:
         return mMessages.count();
     }
 
+    int commitCount() const
+    {
+        return mCommitCount;
+    }
+
     int messageCountForLevel(QsLogging::Level level) const
     {
         return mCountByLevel.value(level);
@@ -65,6 +91,22 @@ public:
 private:
     QHash<QsLogging::Level,int> mCountByLevel;
     QList<Message> mMessages;
+    int mCommitCount;
+};
+
+// A text layout that counts the records it formats
+class CountingLayout : public QsLogging::TextLayout
+{
+public:
+    CountingLayout() : formatCount(0) {}
+
+    virtual QString format(const QsLogging::LogMessage& message)
+    {
+        ++formatCount;
+        return QsLogging::TextLayout::format(message);
+    }
+
+    int formatCount;
 };
 
 // Autotests for QsLog
@@ -84,6 +126,30 @@ private slots:
     void testMessageText();
     void testLevelChanges();
     void testLevelParsing();
+    void testStructuredFields();
+    void testJsonLayout();
+    void testBinaryRoundTrip();
+    void testThreadName();
+    void testScopedContext();
+    void testQtMessageHandler();
+    void testFlushPolicy();
+    void testNativeFileWriter();
+    void testMappedFileWriter();
+    void testIoUringBackend();
+    void testDurableLevel();
+    void testSizeRotation();
+    void testSequenceRotation();
+    void testTimeRotation();
+    void testCompressedRotation();
+    void testGzipFileWriter();
+    void testGzipAppendAfterCrash();
+    void testRetentionBudget();
+    void testSharedRotation();
+    void testRingFile();
+    void testFlightRecorder();
+    void testScopedLogBuffer();
+    void testDestinationFilters();
+    void testRoutingDestination();
     void cleanupTestCase();
 
 private:
@@ -193,6 +259,755 @@ void TestLog::testLevelParsing()
     }
 }
 
+void TestLog::testStructuredFields()
+{
+    mockDest1->clear();
+    QsLogging::Logger::instance().setLoggingLevel(QsLogging::TraceLevel);
+
+    QLOG_INFO() << "request done" << QsLogging::kv("user", 42) << QsLogging::kv("name", "a b");
+    using namespace QsLogging;
+    QVERIFY(mockDest1->hasMessage("request done user=42 name=\"a b\"", InfoLevel));
+    QCOMPARE(mockDest1->messageCount(), 1);
+}
+
+void TestLog::testJsonLayout()
+{
+    using namespace QsLogging;
+    LogMessage message(QString::fromUtf8("say \"hi\"\tto\\ the\nrobot, ok "), WarnLevel, 0);
+    message.fields.push_back(kv("id", 7));
+    message.fields.push_back(kv("ok", true));
+
+    JsonLayout layout;
+    QCOMPARE(layout.format(message),
+             QString::fromUtf8("{\"level\":\"WARN\",\"time\":\"1970-01-01T00:00:00.000Z\","
+                               "\"message\":\"say \\\"hi\\\"\\tto\\\\ the\\nrobot, ok\","
+                               "\"fields\":{\"id\":7,\"ok\":true}}"));
+}
+
+void TestLog::testBinaryRoundTrip()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.qslb");
+
+    LogMessage first(QString::fromUtf8("first"), InfoLevel, 1000);
+    first.fields.push_back(kv("user", 42));
+    first.fields.push_back(kv("ratio", 0.5));
+    LogMessage second(QString::fromUtf8("second"), ErrorLevel, 990);
+    second.fields.push_back(kv("user", QString::fromUtf8("bob")));
+    {
+        BinaryFileDestination dest(path);
+        QVERIFY(dest.isValid());
+        dest.writeMessage(first);
+        dest.writeMessage(second);
+    }
+
+    QFile file(path);
+    QVERIFY(file.open(QFile::ReadOnly));
+    BinaryLogReader reader(file.readAll());
+    LogMessage message;
+    QVERIFY(reader.readNext(message));
+    QCOMPARE(message.formatted(), first.formatted());
+    QVERIFY(reader.readNext(message));
+    QCOMPARE(message.timestamp, qint64(990));
+    QCOMPARE(message.formatted(), second.formatted());
+    QVERIFY(!reader.readNext(message));
+    QVERIFY(!reader.hasError());
+}
+
+void TestLog::testThreadName()
+{
+    using namespace QsLogging;
+    mockDest1->clear();
+    Logger::instance().setIncludeThreadName(true);
+    const QString oldName = QThread::currentThread()->objectName();
+
+    QThread::currentThread()->setObjectName(QString::fromUtf8("robot-main"));
+    QLOG_INFO() << "named";
+    QThread::currentThread()->setObjectName(QString::fromUtf8("robot-renamed"));
+    QLOG_INFO() << "renamed";
+
+    QThread::currentThread()->setObjectName(oldName);
+    Logger::instance().setIncludeThreadName(false);
+    QVERIFY(mockDest1->hasMessage("[robot-main] named", InfoLevel));
+    QVERIFY(mockDest1->hasMessage("[robot-renamed] renamed", InfoLevel));
+}
+
+void TestLog::testScopedContext()
+{
+    mockDest1->clear();
+    {
+        QsLogging::ScopedContext request("req", 17);
+        {
+            QsLogging::ScopedContext session("session", "abc");
+            QLOG_INFO() << "inner" << QsLogging::kv("step", 2);
+        }
+        QLOG_INFO() << "outer";
+    }
+    QLOG_INFO() << "none";
+
+    using namespace QsLogging;
+    QCOMPARE(mockDest1->messageCount(), 3);
+    QVERIFY(mockDest1->hasMessage("inner req=17 session=abc step=2", InfoLevel));
+    QVERIFY(mockDest1->hasMessage("outer req=17", InfoLevel));
+    QVERIFY(!mockDest1->messageAt(1).text.contains("session"));
+    QVERIFY(!mockDest1->messageAt(2).text.contains("req="));
+}
+
+void TestLog::testQtMessageHandler()
+{
+    using namespace QsLogging;
+    mockDest1->clear();
+    Logger::instance().setLoggingLevel(InfoLevel);
+    Logger::instance().installQtMessageHandler();
+
+    QLoggingCategory category("robot.motors");
+    qCWarning(category) << "stalled";
+    qCDebug(category) << "filtered";
+    qWarning("plain warning");
+
+    QVERIFY(!category.isDebugEnabled());
+    QCOMPARE(mockDest1->messageCount(), 2);
+    QVERIFY(mockDest1->hasMessage("robot.motors: stalled", WarnLevel));
+    QVERIFY(mockDest1->hasMessage("plain warning", WarnLevel));
+}
+
+void TestLog::testFlushPolicy()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+
+    FlushPolicy policy;
+    policy.messages = 3;
+    policy.level = ErrorLevel;
+    FileDestination dest(path, RotationStrategyPtr(new NullRotationStrategy),
+                         LayoutPtr(new TextLayout), policy);
+    dest.write(QString::fromUtf8("one"), InfoLevel);
+    dest.write(QString::fromUtf8("two"), InfoLevel);
+    QCOMPARE(QFileInfo(path).size(), qint64(0));
+    dest.write(QString::fromUtf8("three"), InfoLevel);
+    const qint64 afterThree = QFileInfo(path).size();
+    QVERIFY(afterThree > 0);
+
+    dest.write(QString::fromUtf8("four"), InfoLevel);
+    QCOMPARE(QFileInfo(path).size(), afterThree);
+    dest.write(QString::fromUtf8("error"), ErrorLevel);
+    QVERIFY(QFileInfo(path).size() > afterThree);
+
+    dest.write(QString::fromUtf8("five"), InfoLevel);
+    const qint64 beforeFlush = QFileInfo(path).size();
+    dest.flush();
+    QVERIFY(QFileInfo(path).size() > beforeFlush);
+}
+
+void TestLog::testNativeFileWriter()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+
+    {
+        FileDestination dest(path, RotationStrategyPtr(new NullRotationStrategy),
+                             LayoutPtr(new TextLayout), FlushPolicy::manual(),
+                             MakeFileWriter(NativeFileBackend));
+        QVERIFY(dest.isValid());
+        dest.write(QString::fromUtf8("first"), InfoLevel);
+        // larger than the buffer, goes out together with what is buffered
+        dest.write(QString(100 * 1024, QLatin1Char('x')), InfoLevel);
+        dest.write(QString::fromUtf8("\xc3\xa9t\xc3\xa9"), InfoLevel);
+    }
+
+    QFile file(path);
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QList<QByteArray> lines = file.readAll().split('\n');
+    QCOMPARE(lines.size(), 4);
+    QCOMPARE(lines.at(0), QByteArray("first"));
+    QCOMPARE(lines.at(1).size(), 100 * 1024);
+    QCOMPARE(QString::fromUtf8(lines.at(2)), QString::fromUtf8("\xc3\xa9t\xc3\xa9"));
+    QVERIFY(lines.at(3).isEmpty());
+}
+
+void TestLog::testMappedFileWriter()
+{
+#ifdef Q_OS_UNIX
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+    const QByteArray line = QByteArray(1000, 'a') + '\n';
+
+    {
+        MappedFileWriter writer(4096);
+        QVERIFY(writer.open(path, false));
+        for (int i = 0; i < 10; ++i)
+            writer.write(line.constData(), line.size());
+        QCOMPARE(writer.size(), qint64(10 * line.size()));
+    }
+    QCOMPARE(QFileInfo(path).size(), qint64(10 * line.size()));
+
+    // a run that didn't close the file leaves zeroed preallocated space
+    QFile file(path);
+    QVERIFY(file.resize(20000));
+    {
+        MappedFileWriter writer(4096);
+        QVERIFY(writer.open(path, true));
+        QCOMPARE(writer.size(), qint64(10 * line.size()));
+        writer.write("end\n", 4);
+    }
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QByteArray content = file.readAll();
+    QCOMPARE(content.size(), 10 * line.size() + 4);
+    QVERIFY(content.endsWith("a\nend\n"));
+#endif
+}
+
+void TestLog::testIoUringBackend()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+
+    // falls back to the native writer where io_uring can't be used, the result is the same
+    QByteArray expected;
+    {
+        FileDestination dest(path, RotationStrategyPtr(new NullRotationStrategy),
+                             LayoutPtr(new TextLayout), FlushPolicy::manual(),
+                             MakeFileWriter(IoUringFileBackend));
+        for (int i = 0; i < 5000; ++i) {
+            const QString line = QString::fromUtf8("message %1").arg(i);
+            dest.write(line, InfoLevel);
+            expected += line.toUtf8() + '\n';
+            if (i % 1000 == 0)
+                dest.flush();
+        }
+    }
+
+    QFile file(path);
+    QVERIFY(file.open(QFile::ReadOnly));
+    QCOMPARE(file.readAll(), expected);
+}
+
+void TestLog::testDurableLevel()
+{
+    using namespace QsLogging;
+    Logger& logger = Logger::instance();
+    QCOMPARE(logger.durableLevel(), OffLevel);
+    logger.setDurableLevel(ErrorLevel);
+    mockDest1->clear();
+    QLOG_WARN() << "fire and forget";
+    QCOMPARE(mockDest1->commitCount(), 0);
+    QLOG_ERROR() << "durable";
+    QCOMPARE(mockDest1->commitCount(), 1);
+    logger.setDurableLevel(OffLevel);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+    FileDestination dest(path, RotationStrategyPtr(new NullRotationStrategy),
+                         LayoutPtr(new TextLayout), FlushPolicy::manual(),
+                         MakeFileWriter(NativeFileBackend));
+    dest.write(QString::fromUtf8("one"), InfoLevel);
+    dest.write(QString::fromUtf8("two"), ErrorLevel);
+    QCOMPARE(QFileInfo(path).size(), qint64(0));
+    dest.commit();
+    QCOMPARE(QFileInfo(path).size(), qint64(8));
+    // nothing new, nothing to sync
+    dest.commit();
+}
+
+void TestLog::testSizeRotation()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+
+    {
+        QSharedPointer<SizeRotationStrategy> rotation(new SizeRotationStrategy);
+        rotation->setMaximumSizeInBytes(10);
+        rotation->setBackupCount(2);
+        FileDestination dest(path, rotation, LayoutPtr(new TextLayout));
+        for (int i = 0; i < 4; ++i)
+            dest.write(QString::fromUtf8("message %1").arg(i), InfoLevel);
+    }
+
+    // the backups are shifted in the background, destroying the destination waits for it
+    QVERIFY(!QFile::exists(path + QString::fromUtf8(".0")));
+    QVERIFY(QDir(dir.path()).entryList(QStringList(QString::fromUtf8("log.txt.0.*"))).isEmpty());
+    QVERIFY(!QFile::exists(path + QString::fromUtf8(".3")));
+    QFile newest(path + QString::fromUtf8(".1"));
+    QVERIFY(newest.open(QFile::ReadOnly | QFile::Text));
+    QCOMPARE(newest.readAll(), QByteArray("message 1\nmessage 2\n"));
+    QFile oldest(path + QString::fromUtf8(".2"));
+    QVERIFY(oldest.open(QFile::ReadOnly | QFile::Text));
+    QCOMPARE(oldest.readAll(), QByteArray("message 0\n"));
+}
+
+void TestLog::testSequenceRotation()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+
+    for (int run = 0; run < 2; ++run) {
+        QSharedPointer<SequenceRotationStrategy> rotation(new SequenceRotationStrategy);
+        rotation->setMaximumSizeInBytes(5);
+        rotation->setBackupCount(2);
+        FileDestination dest(path, rotation, LayoutPtr(new TextLayout));
+        for (int i = 0; i < 3; ++i)
+            dest.write(QString::fromUtf8("message"), InfoLevel);
+    }
+
+    // numbering continues across runs, only the newest two are kept
+    const QStringList backups = QDir(dir.path()).entryList(QStringList(QString::fromUtf8("log.txt.*")),
+                                                           QDir::Files, QDir::Name);
+    QCOMPARE(backups, QStringList() << QString::fromUtf8("log.txt.000005")
+                                    << QString::fromUtf8("log.txt.000006"));
+}
+
+void TestLog::testTimeRotation()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+    const QDateTime now = QDateTime::currentDateTime();
+    const QDateTime hour(now.date(), QTime(now.time().hour(), 0));
+    const QString longText(1200, QLatin1Char('x'));
+
+    {
+        QSharedPointer<TimeRotationStrategy> timeRotation(new TimeRotationStrategy);
+        timeRotation->setBackupCount(5);
+        QSharedPointer<SizeRotationStrategy> sizeRotation(new SizeRotationStrategy);
+        sizeRotation->setMaximumSizeInBytes(1000);
+        QSharedPointer<CompositeRotationStrategy> rotation(new CompositeRotationStrategy);
+        rotation->addStrategy(timeRotation);
+        rotation->addStrategy(sizeRotation);
+        FileDestination dest(path, rotation, LayoutPtr(new TextLayout));
+
+        const QString text = QString::fromUtf8("message");
+        dest.writeMessage(LogMessage(text, InfoLevel, hour.addSecs(60).toMSecsSinceEpoch()));
+        dest.writeMessage(LogMessage(text, InfoLevel, hour.addSecs(3599).toMSecsSinceEpoch()));
+        dest.writeMessage(LogMessage(text, InfoLevel, hour.addSecs(3600).toMSecsSinceEpoch()));
+        // the size rotates within the hour too
+        dest.writeMessage(LogMessage(longText, InfoLevel, hour.addSecs(3700).toMSecsSinceEpoch()));
+        dest.writeMessage(LogMessage(longText, InfoLevel, hour.addSecs(3800).toMSecsSinceEpoch()));
+    }
+
+    const QString format = QString::fromUtf8("yyyyMMdd-HHmm");
+    const QString first = QString::fromUtf8("log.txt.") + hour.toString(format);
+    const QString second = QString::fromUtf8("log.txt.") + hour.addSecs(3600).toString(format);
+    const QStringList backups = QDir(dir.path()).entryList(QStringList(QString::fromUtf8("log.txt.*")),
+                                                           QDir::Files, QDir::Name);
+    QCOMPARE(backups, QStringList() << first << second << second + QString::fromUtf8(".1"));
+}
+
+void TestLog::testCompressedRotation()
+{
+    using namespace QsLogging;
+    QByteArray roundTrip;
+    QVERIFY(GzipDecompress(GzipCompress("one") + GzipCompress(QByteArray()) + GzipCompress("two"), &roundTrip));
+    QCOMPARE(roundTrip, QByteArray("onetwo"));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+    {
+        QSharedPointer<SizeRotationStrategy> rotation(new SizeRotationStrategy);
+        rotation->setMaximumSizeInBytes(10);
+        rotation->setBackupCount(2);
+        rotation->setCompressBackups(true);
+        FileDestination dest(path, rotation, LayoutPtr(new TextLayout));
+        for (int i = 0; i < 4; ++i)
+            dest.write(QString::fromUtf8("message %1").arg(i), InfoLevel);
+    }
+
+    // a compressed backup is larger than these tiny logs, the budget of 20 bytes keeps one
+    QVERIFY(!QFile::exists(path + QString::fromUtf8(".1")));
+    QVERIFY(!QFile::exists(path + QString::fromUtf8(".2.gz")));
+    QFile backup(path + QString::fromUtf8(".1.gz"));
+    QVERIFY(backup.open(QFile::ReadOnly));
+    QByteArray content;
+    QVERIFY(GzipDecompress(backup.readAll(), &content));
+    QCOMPARE(content, QByteArray("message 1\nmessage 2\n"));
+}
+
+void TestLog::testGzipFileWriter()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt.gz");
+
+    qint64 firstFrameSize = 0;
+    {
+        QSharedPointer<GzipFileWriter> writer(new GzipFileWriter(FileWriterPtr(new QtFileWriter)));
+        FileDestination dest(path, RotationStrategyPtr(new NullRotationStrategy),
+                             LayoutPtr(new TextLayout), FlushPolicy::manual(), writer);
+        dest.write(QString::fromUtf8("one"), InfoLevel);
+        dest.write(QString::fromUtf8("two"), InfoLevel);
+        QCOMPARE(QFileInfo(path).size(), qint64(0));
+        // the open frame isn't in the file yet
+        QCOMPARE(writer->size(), qint64(0));
+        dest.flush();
+        firstFrameSize = QFileInfo(path).size();
+        QVERIFY(firstFrameSize > 0);
+        QCOMPARE(writer->size(), firstFrameSize);
+        dest.write(QString::fromUtf8("three"), InfoLevel);
+    }
+
+    QFile file(path);
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QByteArray compressed = file.readAll();
+    QByteArray content;
+    QVERIFY(GzipDecompress(compressed, &content));
+    QCOMPARE(content, QByteArray("one\ntwo\nthree\n"));
+
+    // a crash in the middle of the second frame loses only that frame
+    content.clear();
+    QVERIFY(!GzipDecompress(compressed.left(compressed.size() - 5), &content));
+    QCOMPARE(content, QByteArray("one\ntwo\n"));
+}
+
+void TestLog::testGzipAppendAfterCrash()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt.gz");
+
+    // a complete member followed by half of one, as a crash leaves them
+    {
+        QFile file(path);
+        QVERIFY(file.open(QFile::WriteOnly));
+        const QByteArray torn = GzipCompress("lost\n");
+        file.write(GzipCompress("one\n") + torn.left(torn.size() / 2));
+    }
+    QVERIFY(GzipCompleteSize(path) < QFileInfo(path).size());
+
+    {
+        // any strategy that appends
+        QSharedPointer<SizeRotationStrategy> rotation(new SizeRotationStrategy);
+        rotation->setMaximumSizeInBytes(1024 * 1024);
+        FileDestination dest(path, rotation, LayoutPtr(new TextLayout), FlushPolicy::manual(),
+                             FileWriterPtr(new GzipFileWriter(FileWriterPtr(new QtFileWriter))));
+        dest.write(QString::fromUtf8("two"), InfoLevel);
+    }
+
+    // the torn member is gone, the records before and after the restart decode
+    QFile file(path);
+    QVERIFY(file.open(QFile::ReadOnly));
+    QByteArray content;
+    QVERIFY(GzipDecompress(file.readAll(), &content));
+    QCOMPARE(content, QByteArray("one\ntwo\n"));
+}
+
+void TestLog::testRetentionBudget()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+
+    // left over from an earlier run, found by the startup sweep and too old to keep
+    QFile stale(path + QString::fromUtf8(".000001"));
+    QVERIFY(stale.open(QFile::WriteOnly));
+    stale.close();
+    QVERIFY(stale.open(QFile::ReadWrite));
+    QVERIFY(stale.setFileTime(QDateTime::currentDateTime().addDays(-3), QFileDevice::FileModificationTime));
+    stale.close();
+
+    {
+        RetentionPolicy retention;
+        retention.maxBytes = 25;
+        retention.maxAgeSeconds = 24 * 60 * 60;
+        QSharedPointer<SequenceRotationStrategy> rotation(new SequenceRotationStrategy);
+        rotation->setMaximumSizeInBytes(5);
+        rotation->setRetention(retention);
+        FileDestination dest(path, rotation, LayoutPtr(new TextLayout));
+        for (int i = 0; i < 6; ++i)
+            dest.write(QString::fromUtf8("message"), InfoLevel);
+    }
+
+    // no count limit, the 8 byte backups are kept while they fit in 25 bytes
+    const QStringList backups = QDir(dir.path()).entryList(QStringList(QString::fromUtf8("log.txt.*")),
+                                                           QDir::Files, QDir::Name);
+    QCOMPARE(backups, QStringList() << QString::fromUtf8("log.txt.000005")
+                                    << QString::fromUtf8("log.txt.000006")
+                                    << QString::fromUtf8("log.txt.000007"));
+}
+
+void TestLog::testSharedRotation()
+{
+#ifdef Q_OS_UNIX
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/log.txt");
+
+    // two destinations on one file stand in for two processes
+    QStringList expected;
+    {
+        DestinationPtr first = DestinationFactory::MakeFileDestination(path,
+            EnableSharedLogRotation, MaxSizeBytes(20), MaxOldLogCount(10));
+        DestinationPtr second = DestinationFactory::MakeFileDestination(path,
+            EnableSharedLogRotation, MaxSizeBytes(20), MaxOldLogCount(10));
+        for (int i = 0; i < 10; ++i) {
+            const QString a = QString::fromUtf8("a %1").arg(i);
+            const QString b = QString::fromUtf8("b %1").arg(i);
+            first->write(a, InfoLevel);
+            second->write(b, InfoLevel);
+            expected << a << b;
+        }
+    }
+
+    // every line ends up in exactly one file, and rotations happened only once each
+    QStringList lines;
+    const QStringList files = QDir(dir.path()).entryList(QStringList(QString::fromUtf8("log.txt*")),
+                                                         QDir::Files, QDir::Name);
+    QVERIFY(files.size() > 2);
+    for (const QString& name : files) {
+        if (name.endsWith(QString::fromUtf8(".lock")))
+            continue;
+        QFile file(dir.filePath(name));
+        QVERIFY(file.open(QFile::ReadOnly | QFile::Text));
+        const QString content = QString::fromUtf8(file.readAll());
+        QVERIFY(content.size() <= 24);
+        lines << content.split(QLatin1Char('\n'));
+    }
+    lines.removeAll(QString());
+    lines.sort();
+    expected.sort();
+    QCOMPARE(lines, expected);
+#endif
+}
+
+void TestLog::testRingFile()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + QString::fromUtf8("/ring.log");
+
+    // the second run continues the ring left by the first
+    for (int run = 0; run < 2; ++run) {
+        RingFileDestination dest(path, RingFileDestination::MinimumSize);
+        QVERIFY(dest.isValid());
+        for (int i = 0; i < 200; ++i)
+            dest.write(QString::fromUtf8("message %1").arg(run * 200 + i), InfoLevel);
+    }
+
+    QFile file(path);
+    QVERIFY(file.open(QFile::ReadOnly));
+    QCOMPARE(file.size(), RingFileDestination::MinimumSize);
+    RingLogReader reader(file.readAll());
+    QVERIFY(reader.isValid());
+    QVERIFY(reader.generation() > 0);
+
+    // the newest messages, in order
+    QStringList lines;
+    QString line;
+    while (reader.readNext(line))
+        lines << line;
+    QVERIFY(lines.size() > 100);
+    QVERIFY(lines.size() < 400);
+    for (int i = 0; i < lines.size(); ++i)
+        QCOMPARE(lines.at(i), QString::fromUtf8("message %1").arg(400 - lines.size() + i));
+}
+
+void TestLog::testFlightRecorder()
+{
+    using namespace QsLogging;
+    Logger& logger = Logger::instance();
+    logger.setLoggingLevel(InfoLevel);
+    QSharedPointer<MockDestination> dumps(new MockDestination);
+    QSharedPointer<FlightRecorderDestination> recorder(new FlightRecorderDestination(dumps, 4));
+    logger.addDestination(recorder);
+    QCOMPARE(logger.effectiveLevel(), TraceLevel);
+    mockDest1->clear();
+
+    // TRACE reaches the recorder only, and stays in memory until the error
+    for (int i = 0; i < 6; ++i)
+        QLOG_TRACE() << "step" << i;
+    QCOMPARE(mockDest1->messageCount(), 0);
+    QCOMPARE(dumps->messageCount(), 0);
+
+    // the dump runs on the recorder's thread, flushing waits for it
+    QLOG_ERROR() << "failed";
+    logger.flush();
+    QCOMPARE(mockDest1->messageCount(), 1);
+    QCOMPARE(dumps->messageCount(), 4);
+    QVERIFY(dumps->messageAt(0).text.contains(QString::fromUtf8("step 3")));
+    QCOMPARE(dumps->messageAt(3).level, ErrorLevel);
+
+    // a later dump only adds what was recorded since
+    QLOG_DEBUG() << "after";
+    recorder->dump();
+    QCOMPARE(dumps->messageCount(), 5);
+
+    // the target is the recorder's alone, the logger refuses to share it
+    QVERIFY(!logger.addDestination(dumps));
+    QLOG_INFO() << "direct";
+    QCOMPARE(dumps->messageCount(), 5);
+    QSharedPointer<FlightRecorderDestination> sharing(new FlightRecorderDestination(mockDest1, 4));
+    QVERIFY(!logger.addDestination(sharing));
+
+    logger.removeDestination(recorder);
+    QCOMPARE(logger.effectiveLevel(), InfoLevel);
+}
+
+void TestLog::testScopedLogBuffer()
+{
+    using namespace QsLogging;
+    Logger::instance().setLoggingLevel(InfoLevel);
+    mockDest1->clear();
+    {
+        ScopedLogBuffer buffer;
+        QLOG_DEBUG() << "detail";
+        QLOG_INFO() << "normal";
+    }
+    // nothing went wrong, the detail is dropped
+    QCOMPARE(mockDest1->messageCount(), 1);
+    QCOMPARE(mockDest1->messageAt(0).level, InfoLevel);
+
+    mockDest1->clear();
+    {
+        ScopedLogBuffer buffer;
+        QLOG_TRACE() << "first";
+        QLOG_DEBUG() << "second";
+        QCOMPARE(mockDest1->messageCount(), 0);
+        QVERIFY(!buffer.isEscalated());
+        QLOG_WARN() << "trouble";
+        QVERIFY(buffer.isEscalated());
+        QLOG_DEBUG() << "after";
+    }
+    QLOG_DEBUG() << "outside";
+    QCOMPARE(mockDest1->messageCount(), 4);
+    QVERIFY(mockDest1->messageAt(0).text.contains(QString::fromUtf8("first")));
+    QVERIFY(mockDest1->messageAt(1).text.contains(QString::fromUtf8("second")));
+    QCOMPARE(mockDest1->messageAt(2).level, WarnLevel);
+    QVERIFY(mockDest1->messageAt(3).text.contains(QString::fromUtf8("after")));
+
+    // a recorder takes the kept records right away, and not again on escalation
+    QSharedPointer<MockDestination> dumps(new MockDestination);
+    QSharedPointer<FlightRecorderDestination> recorder(new FlightRecorderDestination(dumps, 8));
+    Logger::instance().addDestination(recorder);
+    mockDest1->clear();
+    {
+        ScopedLogBuffer buffer;
+        QLOG_DEBUG() << "kept";
+        recorder->dump();
+        QCOMPARE(dumps->messageCount(), 1);
+        QCOMPARE(mockDest1->messageCount(), 0);
+        QLOG_WARN() << "trouble";
+    }
+    recorder->dump();
+    QCOMPARE(dumps->messageCount(), 2);
+    QCOMPARE(mockDest1->messageCount(), 2);
+    Logger::instance().removeDestination(recorder);
+}
+
+void TestLog::testDestinationFilters()
+{
+    using namespace QsLogging;
+    Logger& logger = Logger::instance();
+    logger.removeDestination(mockDest1);
+    logger.removeDestination(mockDest2);
+    logger.setLoggingLevel(TraceLevel);
+
+    QSharedPointer<MockDestination> console(new MockDestination);
+    console->setLevel(WarnLevel);
+    QSharedPointer<MockDestination> file(new MockDestination);
+    file->setLevel(DebugLevel);
+    QSharedPointer<MockDestination> robot(new MockDestination);
+    robot->setCategories(QList<QByteArray>() << QByteArray("robot"));
+    robot->setLevel(DebugLevel);
+    logger.addDestination(console);
+    logger.addDestination(file);
+    logger.addDestination(robot);
+    // no destination takes TRACE, the macros don't even build it
+    QCOMPARE(logger.effectiveLevel(), DebugLevel);
+
+    QLOG_TRACE() << "never built";
+    QLOG_DEBUG() << "detail";
+    QLOG_WARN() << "warning";
+    QLoggingCategory category("robot.motors");
+    qCWarning(category) << "stalled";
+
+    QCOMPARE(console->messageCount(), 2);
+    QCOMPARE(file->messageCount(), 3);
+    QCOMPARE(robot->messageCount(), 1);
+    QVERIFY(robot->hasMessage("robot.motors: stalled", WarnLevel));
+
+    logger.removeDestination(console);
+    logger.removeDestination(file);
+    logger.removeDestination(robot);
+    logger.addDestination(mockDest1);
+    logger.addDestination(mockDest2);
+}
+
+void TestLog::testRoutingDestination()
+{
+    using namespace QsLogging;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString errorsPath = dir.path() + QString::fromUtf8("/errors.log");
+    const QString netPath = dir.path() + QString::fromUtf8("/net.log");
+
+    QSharedPointer<CountingLayout> layout(new CountingLayout);
+    RoutingDestination router(layout);
+    router.addLevelRoute(ErrorLevel, FatalLevel, router.makeFile(errorsPath));
+    router.addCategoryRoute("net", router.makeFile(netPath));
+    QSharedPointer<MockDestination> all(new MockDestination);
+    router.addLevelRoute(TraceLevel, FatalLevel, all);
+    QSharedPointer<MockDestination> warnings(new MockDestination);
+    warnings->setLevel(WarnLevel);
+    router.addLevelRoute(TraceLevel, FatalLevel, warnings);
+    QVERIFY(router.isValid());
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    LogMessage connected(QString::fromUtf8("connected"), InfoLevel, now);
+    connected.category = "net.tcp";
+    LogMessage reset(QString::fromUtf8("connection reset"), ErrorLevel, now);
+    reset.category = "net";
+    LogMessage diskFull(QString::fromUtf8("disk full"), ErrorLevel, now);
+    LogMessage network(QString::fromUtf8("not routed"), InfoLevel, now);
+    network.category = "network";
+    router.writeMessage(connected);
+    router.writeMessage(reset);
+    router.writeMessage(diskFull);
+    router.writeMessage(network);
+    router.flush();
+
+    // the reset goes to both files and is formatted once, the mock formats for itself
+    QCOMPARE(layout->formatCount, 3);
+    QCOMPARE(all->messageCount(), 4);
+    // a route doesn't override the destination's own level
+    QCOMPARE(warnings->messageCount(), 2);
+
+    QFile errors(errorsPath);
+    QVERIFY(errors.open(QFile::ReadOnly));
+    QStringList lines = QString::fromUtf8(errors.readAll()).split(QLatin1Char('\n'));
+    lines.removeAll(QString());
+    QCOMPARE(lines.size(), 2);
+    QVERIFY(lines.at(0).contains(QString::fromUtf8("connection reset")));
+    QVERIFY(lines.at(1).contains(QString::fromUtf8("disk full")));
+
+    QFile net(netPath);
+    QVERIFY(net.open(QFile::ReadOnly));
+    lines = QString::fromUtf8(net.readAll()).split(QLatin1Char('\n'));
+    lines.removeAll(QString());
+    QCOMPARE(lines.size(), 2);
+    QVERIFY(lines.at(0).contains(QString::fromUtf8("connected")));
+    QVERIFY(lines.at(1).contains(QString::fromUtf8("connection reset")));
+}
+
 void TestLog::cleanupTestCase()
 {
     QsLogging::Logger::destroyInstance();